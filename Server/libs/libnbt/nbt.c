@@ -38,10 +38,67 @@
     int LIBNBT_compress_zlib(uint8_t* dest, size_t* destsize, uint8_t* src, size_t srcsize);
 #endif
 
+#ifdef _MSC_VER
+    #include <intrin.h>
+    #define LIBNBT_THREAD_LOCAL __declspec(thread)
+    #define LIBNBT_ATOMIC_ADD(target, value) _InterlockedExchangeAdd64((volatile int64_t*)(target), (int64_t)(value))
+    #define LIBNBT_ATOMIC_LOAD(target) ((uint64_t)_InterlockedCompareExchange64((volatile int64_t*)(target), 0, 0))
+#else
+    #define LIBNBT_THREAD_LOCAL __thread
+    #define LIBNBT_ATOMIC_ADD(target, value) __atomic_fetch_add((target), (value), __ATOMIC_RELAXED)
+    #define LIBNBT_ATOMIC_LOAD(target) __atomic_load_n((target), __ATOMIC_RELAXED)
+#endif
+
+// Smallest output buffer tried first, and the best ratio deflate can reach
+#define LIBNBT_MIN_INFLATE (1 << 16)
+#define LIBNBT_MAX_RATIO 1032
+
+// Shared by all threads, updated atomically
+static NBT_Inflate_Stats LIBNBT_inflate_stats;
+
+// Bump allocator behind NBT_Parse_Arena. The root node is the first thing
+// in the first block, so the arena can be found from it again; the first
+// block also tracks the one currently being filled.
+typedef struct LIBNBT_Arena {
+    struct LIBNBT_Arena* next;
+    struct LIBNBT_Arena* current;
+    size_t size;
+    size_t used;
+    // inflated input a borrowed tree points into, first block only
+    void* input;
+} LIBNBT_Arena;
+
+// Header rounded up so allocations after it stay 16 byte aligned
+#define LIBNBT_ARENA_HEADER ((sizeof(LIBNBT_Arena) + 15) & ~(size_t)15)
+#define LIBNBT_ARENA_BLOCK (1 << 16)
+
+// Set on every node of an arena tree, and on its root
+#define LIBNBT_FLAG_ARENA 1
+#define LIBNBT_FLAG_ARENA_ROOT 2
+// value_a points into the parsed data rather than a copy
+#define LIBNBT_FLAG_BORROWED 4
+// Borrowed int or long array whose elements are still big endian
+#define LIBNBT_FLAG_BIG_ENDIAN 8
+
+// Open addressing over a compound's children, twice as many slots as
+// children at least. When keys repeat only the first child is in it, the
+// one a walk over the children would find.
+typedef struct NBT_Index {
+    uint32_t mask;
+    struct {
+        uint32_t hash;
+        NBT* node;
+    } slots[];
+} NBT_Index;
+
 typedef struct NBT_Buffer {
     uint8_t* data;
     size_t len;
     size_t pos;
+    // where parsed nodes go, NULL to malloc each
+    LIBNBT_Arena* arena;
+    // leave arrays and strings in data instead of copying them
+    int borrow;
 } NBT_Buffer;
 
 #define isValidTag(tag) ((tag)>TAG_End && (tag)<=TAG_Long_Array)
@@ -64,6 +121,148 @@ typedef struct NBT_Buffer {
 #include <byteswap.h>
 #endif
 
+// Int and long arrays are byte swapped in bulk, 32 or 16 bytes at a time
+// where the CPU can shuffle them, picked once at runtime
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    #define LIBNBT_SIMD_X86
+    #include <immintrin.h>
+    #ifdef _MSC_VER
+        #define LIBNBT_TARGET(isa)
+    #else
+        #include <cpuid.h>
+        #define LIBNBT_TARGET(isa) __attribute__((target(isa)))
+    #endif
+#endif
+
+#define LIBNBT_SWAP_SCALAR 0
+#define LIBNBT_SWAP_SSSE3 1
+#define LIBNBT_SWAP_AVX2 2
+
+void LIBNBT_swap_scalar(uint8_t* dest, const uint8_t* src, size_t count, int width) {
+    size_t i;
+    if (width == 4) {
+        for (i = 0; i < count; i++) {
+            uint32_t value;
+            memcpy(&value, src + i * 4, 4);
+            value = bswap_32(value);
+            memcpy(dest + i * 4, &value, 4);
+        }
+    } else {
+        for (i = 0; i < count; i++) {
+            uint64_t value;
+            memcpy(&value, src + i * 8, 8);
+            value = bswap_64(value);
+            memcpy(dest + i * 8, &value, 8);
+        }
+    }
+}
+
+#ifdef LIBNBT_SIMD_X86
+LIBNBT_TARGET("ssse3")
+void LIBNBT_swap_ssse3(uint8_t* dest, const uint8_t* src, size_t count, int width) {
+    const __m128i mask = width == 4
+        ? _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12)
+        : _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    size_t bytes = count * width;
+    size_t i = 0;
+    for (; i + 16 <= bytes; i += 16) {
+        __m128i value = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)(dest + i), _mm_shuffle_epi8(value, mask));
+    }
+    LIBNBT_swap_scalar(dest + i, src + i, (bytes - i) / width, width);
+}
+
+LIBNBT_TARGET("avx2")
+void LIBNBT_swap_avx2(uint8_t* dest, const uint8_t* src, size_t count, int width) {
+    // The shuffle works within each 16 byte lane, so the mask is repeated
+    const __m256i mask = width == 4
+        ? _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                           3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12)
+        : _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                           7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    size_t bytes = count * width;
+    size_t i = 0;
+    for (; i + 64 <= bytes; i += 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(src + i + 32));
+        _mm256_storeu_si256((__m256i*)(dest + i), _mm256_shuffle_epi8(a, mask));
+        _mm256_storeu_si256((__m256i*)(dest + i + 32), _mm256_shuffle_epi8(b, mask));
+    }
+    for (; i + 32 <= bytes; i += 32) {
+        __m256i value = _mm256_loadu_si256((const __m256i*)(src + i));
+        _mm256_storeu_si256((__m256i*)(dest + i), _mm256_shuffle_epi8(value, mask));
+    }
+    LIBNBT_swap_scalar(dest + i, src + i, (bytes - i) / width, width);
+}
+#endif
+
+int LIBNBT_swap_level(void) {
+#ifdef LIBNBT_SIMD_X86
+    unsigned int a = 0, b = 0, c = 0, d = 0;
+    int level = LIBNBT_SWAP_SCALAR;
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    int max = info[0];
+    __cpuid(info, 1);
+    c = (unsigned int)info[2];
+#else
+    int max = __get_cpuid_max(0, NULL);
+    __get_cpuid(1, &a, &b, &c, &d);
+#endif
+    if (c & (1u << 9)) {
+        level = LIBNBT_SWAP_SSSE3;
+    }
+
+    // AVX2 also needs the OS to save the upper halves of the registers
+    unsigned int xcr0 = 0;
+    if ((c & (1u << 27)) && (c & (1u << 28))) {
+#ifdef _MSC_VER
+        xcr0 = (unsigned int)_xgetbv(0);
+#else
+        unsigned int high;
+        __asm__ volatile ("xgetbv" : "=a"(xcr0), "=d"(high) : "c"(0));
+#endif
+    }
+    if (max >= 7 && (xcr0 & 6) == 6) {
+#ifdef _MSC_VER
+        __cpuidex(info, 7, 0);
+        b = (unsigned int)info[1];
+#else
+        __cpuid_count(7, 0, a, b, c, d);
+#endif
+        if (b & (1u << 5)) {
+            level = LIBNBT_SWAP_AVX2;
+        }
+    }
+    return level;
+#else
+    return LIBNBT_SWAP_SCALAR;
+#endif
+}
+
+// Swaps count elements of width 4 or 8 bytes from src into dest, which may
+// be the same; neither has to be aligned
+void LIBNBT_swap(void* dest, const void* src, size_t count, int width) {
+    // Every thread works out the same answer, so racing on it is harmless
+    static volatile int level = -1;
+    if (level < 0) {
+        level = LIBNBT_swap_level();
+    }
+
+#ifdef LIBNBT_SIMD_X86
+    if (level == LIBNBT_SWAP_AVX2) {
+        LIBNBT_swap_avx2(dest, src, count, width);
+        return;
+    }
+    if (level == LIBNBT_SWAP_SSSE3) {
+        LIBNBT_swap_ssse3(dest, src, count, width);
+        return;
+    }
+#endif
+    LIBNBT_swap_scalar(dest, src, count, width);
+}
+
 #ifndef _MSC_VER
 #define BUFFER_SPRINTF(buffer, str...) {                        \
     char* buf = (char*)&(buffer)->data[(buffer)->pos];          \
@@ -97,6 +296,16 @@ typedef struct NBT_Buffer {
 
 NBT* LIBNBT_create_NBT(uint8_t type);
 NBT_Buffer* LIBNBT_init_buffer(uint8_t* data, int length);
+LIBNBT_Arena* LIBNBT_arena_create(size_t size);
+void* LIBNBT_arena_alloc(LIBNBT_Arena* arena, size_t size);
+void LIBNBT_arena_free(LIBNBT_Arena* arena);
+int LIBNBT_borrow(NBT* saveto, NBT_Buffer* buffer, uint32_t count, size_t element);
+LIBNBT_Arena* LIBNBT_tree_arena(NBT* node);
+int LIBNBT_key_equals(const char* a, const char* b);
+size_t LIBNBT_index_size(uint32_t count);
+void LIBNBT_index_fill(NBT_Index* index, NBT* compound, uint32_t count);
+void* LIBNBT_alloc(NBT_Buffer* buffer, size_t size);
+NBT* LIBNBT_alloc_NBT(NBT_Buffer* buffer, uint8_t type);
 int LIBNBT_getUint8(NBT_Buffer* buffer, uint8_t* result);
 int LIBNBT_getUint16(NBT_Buffer* buffer, uint16_t* result);
 int LIBNBT_getUint32(NBT_Buffer* buffer, uint32_t* result);
@@ -128,6 +337,9 @@ int LIBNBT_nbt_write_string(NBT_Buffer* buffer, void* value, int32_t len, char*
 int LIBNBT_nbt_write_compound(NBT_Buffer* buffer, NBT* root);
 int LIBNBT_nbt_write_list(NBT_Buffer* buffer, NBT* root);
 void LIBNBT_fill_err(NBT_Error* err, int errid, int position);
+uint32_t LIBNBT_read_be32(const uint8_t* p);
+size_t LIBNBT_fixed_size(uint8_t type);
+int LIBNBT_reader_payload(NBT_Reader* reader, NBT_Token* token);
 
 NBT* LIBNBT_create_NBT(uint8_t type) {
     NBT* root = malloc(sizeof(NBT));
@@ -144,9 +356,146 @@ NBT_Buffer* LIBNBT_init_buffer(uint8_t* data, int length) {
     buffer->data = data;
     buffer->len = length;
     buffer->pos = 0;
+    buffer->arena = NULL;
+    buffer->borrow = 0;
     return buffer;
 }
 
+LIBNBT_Arena* LIBNBT_arena_create(size_t size) {
+    LIBNBT_Arena* arena = malloc(LIBNBT_ARENA_HEADER + size);
+    if (arena == NULL) {
+        return NULL;
+    }
+    arena->next = NULL;
+    arena->current = arena;
+    arena->size = size;
+    arena->used = 0;
+    arena->input = NULL;
+    return arena;
+}
+
+void* LIBNBT_arena_alloc(LIBNBT_Arena* arena, size_t size) {
+    size = (size + 7) & ~(size_t)7;
+
+    LIBNBT_Arena* block = arena->current;
+    if (block->used + size > block->size) {
+        // Anything large gets a block of its own, linked in behind the
+        // current one so the space left there is still used
+        if (size > LIBNBT_ARENA_BLOCK / 4) {
+            LIBNBT_Arena* own = LIBNBT_arena_create(size);
+            if (own == NULL) {
+                return NULL;
+            }
+            own->used = size;
+            own->next = block->next;
+            block->next = own;
+            return (uint8_t*)own + LIBNBT_ARENA_HEADER;
+        }
+
+        LIBNBT_Arena* fresh = LIBNBT_arena_create(LIBNBT_ARENA_BLOCK);
+        if (fresh == NULL) {
+            return NULL;
+        }
+        fresh->next = block->next;
+        block->next = fresh;
+        arena->current = fresh;
+        block = fresh;
+    }
+
+    void* result = (uint8_t*)block + LIBNBT_ARENA_HEADER + block->used;
+    block->used += size;
+    return result;
+}
+
+void LIBNBT_arena_free(LIBNBT_Arena* arena) {
+    while (arena) {
+        LIBNBT_Arena* next = arena->next;
+        free(arena->input);
+        free(arena);
+        arena = next;
+    }
+}
+
+void* LIBNBT_alloc(NBT_Buffer* buffer, size_t size) {
+    if (buffer->arena) {
+        return LIBNBT_arena_alloc(buffer->arena, size);
+    }
+    return malloc(size);
+}
+
+NBT* LIBNBT_alloc_NBT(NBT_Buffer* buffer, uint8_t type) {
+    if (buffer->arena == NULL) {
+        return LIBNBT_create_NBT(type);
+    }
+    NBT* node = LIBNBT_arena_alloc(buffer->arena, sizeof(NBT));
+    if (node == NULL) {
+        return NULL;
+    }
+    memset(node, 0, sizeof(NBT));
+    node->type = type;
+    node->flags = LIBNBT_FLAG_ARENA;
+    return node;
+}
+
+// Points an array or string at its elements in the buffer, the count
+// already read
+int LIBNBT_borrow(NBT* saveto, NBT_Buffer* buffer, uint32_t count, size_t element) {
+    if (count > (buffer->len - buffer->pos) / element) {
+        return LIBNBT_ERROR_EARLY_EOF;
+    }
+    saveto->value_a.value = buffer->data + buffer->pos;
+    saveto->value_a.len = count;
+    saveto->flags |= LIBNBT_FLAG_BORROWED;
+    if (element > 1) {
+        saveto->flags |= LIBNBT_FLAG_BIG_ENDIAN;
+    }
+    buffer->pos += count * element;
+    return 0;
+}
+
+// Arena of the tree an arena node is in; its root is at the start of it
+LIBNBT_Arena* LIBNBT_tree_arena(NBT* node) {
+    while (node->parent) {
+        node = node->parent;
+    }
+    return (LIBNBT_Arena*)((uint8_t*)node - LIBNBT_ARENA_HEADER);
+}
+
+// Empty keys are parsed as NULL
+int LIBNBT_key_equals(const char* a, const char* b) {
+    return strcmp(a ? a : "", b ? b : "") == 0;
+}
+
+size_t LIBNBT_index_size(uint32_t count) {
+    size_t slots = 16;
+    while (slots < (size_t)count * 2) {
+        slots *= 2;
+    }
+    return sizeof(NBT_Index) + slots * sizeof(((NBT_Index*)0)->slots[0]);
+}
+
+void LIBNBT_index_fill(NBT_Index* index, NBT* compound, uint32_t count) {
+    size_t slots = (LIBNBT_index_size(count) - sizeof(NBT_Index)) / sizeof(index->slots[0]);
+    memset(index->slots, 0, slots * sizeof(index->slots[0]));
+    index->mask = (uint32_t)slots - 1;
+
+    NBT* child;
+    for (child = compound->child; child; child = child->next) {
+        uint32_t hash = NBT_Hash_Key(child->key);
+        uint32_t i = hash & index->mask;
+        while (index->slots[i].node) {
+            if (index->slots[i].hash == hash && LIBNBT_key_equals(index->slots[i].node->key, child->key)) {
+                break;
+            }
+            i = (i + 1) & index->mask;
+        }
+        if (index->slots[i].node == NULL) {
+            index->slots[i].hash = hash;
+            index->slots[i].node = child;
+        }
+    }
+}
+
 int LIBNBT_getUint8(NBT_Buffer* buffer, uint8_t* result) {
     if (buffer->pos + 1 > buffer->len) {
         return 0;
@@ -274,7 +623,10 @@ int LIBNBT_getKey(NBT_Buffer* buffer, char** result) {
     if (buffer->pos + len > buffer->len) {
         return 0;
     }
-    *result = malloc(len + 1);
+    *result = LIBNBT_alloc(buffer, len + 1);
+    if (*result == NULL) {
+        return 0;
+    }
     memcpy(*result, buffer->data + buffer->pos, len);
     (*result)[len] = 0;
     buffer->pos += len;
@@ -360,7 +712,10 @@ int LIBNBT_parse_value(NBT* saveto, NBT_Buffer* buffer, uint8_t skipkey) {
             if (!LIBNBT_getUint32(buffer, &len)) {
                 return LIBNBT_ERROR_EARLY_EOF;
             }
-            saveto->value_a.value = malloc(len);
+            if (buffer->borrow) {
+                return LIBNBT_borrow(saveto, buffer, len, 1);
+            }
+            saveto->value_a.value = LIBNBT_alloc(buffer, len);
             saveto->value_a.len = len;
             if (buffer->pos + len > buffer->len) {
                 return LIBNBT_ERROR_EARLY_EOF;
@@ -374,7 +729,13 @@ int LIBNBT_parse_value(NBT* saveto, NBT_Buffer* buffer, uint8_t skipkey) {
             if (!LIBNBT_getUint16(buffer, &len)) {
                 return LIBNBT_ERROR_EARLY_EOF;
             }
-            saveto->value_a.value = malloc(len + 1);
+            if (buffer->borrow) {
+                // Still counts the '\0' there is no room for in the buffer
+                int ret = LIBNBT_borrow(saveto, buffer, len, 1);
+                saveto->value_a.len = len + 1;
+                return ret;
+            }
+            saveto->value_a.value = LIBNBT_alloc(buffer, len + 1);
             saveto->value_a.len = len + 1;
             if (buffer->pos + len > buffer->len) {
                 return LIBNBT_ERROR_EARLY_EOF;
@@ -399,11 +760,12 @@ int LIBNBT_parse_value(NBT* saveto, NBT_Buffer* buffer, uint8_t skipkey) {
             int i;
             NBT* last = NULL;
             for (i = 0; i < len; i ++) {
-                NBT* child = LIBNBT_create_NBT(listtype);
-                int ret = LIBNBT_parse_value(child, buffer, 1);
-                if (ret) {
-                    return ret;
+                NBT* child = LIBNBT_alloc_NBT(buffer, listtype);
+                if (child == NULL) {
+                    return LIBNBT_ERROR_INTERNAL;
                 }
+                // Linked before it's parsed, so freeing the tree after an
+                // error takes the half parsed child too
                 if (i == 0) {
                     last = child;
                     saveto->child = child;
@@ -414,11 +776,16 @@ int LIBNBT_parse_value(NBT* saveto, NBT_Buffer* buffer, uint8_t skipkey) {
                     last = child;
                     child->parent = saveto;
                 }
+                int ret = LIBNBT_parse_value(child, buffer, 1);
+                if (ret) {
+                    return ret;
+                }
             }
             break;
         }
         case TAG_Compound: {
             NBT* last = NULL;
+            uint32_t count = 0;
             while (1) {
                 uint8_t listtype;
                 if (!LIBNBT_getUint8(buffer, &listtype)) {
@@ -427,10 +794,10 @@ int LIBNBT_parse_value(NBT* saveto, NBT_Buffer* buffer, uint8_t skipkey) {
                 if (listtype == 0) {
                     break;
                 }
-                NBT* child = LIBNBT_create_NBT(listtype);
-                int ret = LIBNBT_parse_value(child, buffer, 0);
-                if (ret) {
-                    return ret;
+                count++;
+                NBT* child = LIBNBT_alloc_NBT(buffer, listtype);
+                if (child == NULL) {
+                    return LIBNBT_ERROR_INTERNAL;
                 }
                 if (last == NULL) {
                     saveto->child = child;
@@ -442,6 +809,18 @@ int LIBNBT_parse_value(NBT* saveto, NBT_Buffer* buffer, uint8_t skipkey) {
                     last = child;
                     child->parent = saveto;
                 }
+                int ret = LIBNBT_parse_value(child, buffer, 0);
+                if (ret) {
+                    return ret;
+                }
+            }
+            // The tree is fine without one, so running out of memory here
+            // isn't an error
+            if (count >= NBT_INDEX_MIN) {
+                saveto->index = LIBNBT_alloc(buffer, LIBNBT_index_size(count));
+                if (saveto->index) {
+                    LIBNBT_index_fill(saveto->index, saveto, count);
+                }
             }
             break;
         }
@@ -450,19 +829,17 @@ int LIBNBT_parse_value(NBT* saveto, NBT_Buffer* buffer, uint8_t skipkey) {
             if (!LIBNBT_getUint32(buffer, &len)) {
                 return LIBNBT_ERROR_EARLY_EOF;
             }
+            if (buffer->borrow) {
+                return LIBNBT_borrow(saveto, buffer, len, 4);
+            }
             len *= 4;
-            saveto->value_a.value = malloc(len);
+            saveto->value_a.value = LIBNBT_alloc(buffer, len);
             saveto->value_a.len = len/4;
             if (buffer->pos + len > buffer->len) {
                 return LIBNBT_ERROR_EARLY_EOF;
             }
-            memcpy(saveto->value_a.value, buffer->data + buffer->pos, len);
+            LIBNBT_swap(saveto->value_a.value, buffer->data + buffer->pos, len/4, 4);
             buffer->pos += len;
-            int i;
-            uint32_t* value = (uint32_t*)saveto->value_a.value;
-            for (i = 0; i < len/4; i ++) {
-                value[i] = bswap_32(value[i]);
-            }
             break;
         }
         case TAG_Long_Array: {
@@ -470,19 +847,17 @@ int LIBNBT_parse_value(NBT* saveto, NBT_Buffer* buffer, uint8_t skipkey) {
             if (!LIBNBT_getUint32(buffer, &len)) {
                 return LIBNBT_ERROR_EARLY_EOF;
             }
+            if (buffer->borrow) {
+                return LIBNBT_borrow(saveto, buffer, len, 8);
+            }
             len *= 8;
-            saveto->value_a.value = malloc(len);
+            saveto->value_a.value = LIBNBT_alloc(buffer, len);
             saveto->value_a.len = len/8;
             if (buffer->pos + len > buffer->len) {
                 return LIBNBT_ERROR_EARLY_EOF;
             }
-            memcpy(saveto->value_a.value, buffer->data + buffer->pos, len);
+            LIBNBT_swap(saveto->value_a.value, buffer->data + buffer->pos, len/8, 8);
             buffer->pos += len;
-            int i;
-            uint64_t* value = (uint64_t*)saveto->value_a.value;
-            for (i = 0; i < len/8; i ++) {
-                value[i] = bswap_64(value[i]);
-            }
             break;
         }
         default:
@@ -691,6 +1066,7 @@ int LIBNBT_snbt_write_nbt(NBT_Buffer* buffer, NBT* root, int level, int space, i
         case TAG_Long_Array:
         ret = LIBNBT_snbt_write_space(buffer, space * curlevel);
         if (ret) return ret;
+        if (NBT_Get_Array(root) == NULL && root->value_a.len) return LIBNBT_ERROR_INTERNAL;
         ret = LIBNBT_snbt_write_array(buffer, root->value_a.value, root->value_a.len, root->key, root->type);
         if (ret) return ret;
         return 0;
@@ -713,6 +1089,14 @@ int LIBNBT_snbt_write_nbt(NBT_Buffer* buffer, NBT* root, int level, int space, i
     }
 }
 
+void NBT_Get_Inflate_Stats(NBT_Inflate_Stats* stats) {
+    stats->calls = LIBNBT_ATOMIC_LOAD(&LIBNBT_inflate_stats.calls);
+    stats->retries = LIBNBT_ATOMIC_LOAD(&LIBNBT_inflate_stats.retries);
+    stats->failures = LIBNBT_ATOMIC_LOAD(&LIBNBT_inflate_stats.failures);
+    stats->bytes_in = LIBNBT_ATOMIC_LOAD(&LIBNBT_inflate_stats.bytes_in);
+    stats->bytes_out = LIBNBT_ATOMIC_LOAD(&LIBNBT_inflate_stats.bytes_out);
+}
+
 void LIBNBT_fill_err(NBT_Error* err, int errid, int position) {
     if (err == NULL) {
         return;
@@ -723,6 +1107,13 @@ void LIBNBT_fill_err(NBT_Error* err, int errid, int position) {
 
 #ifndef LIBNBT_USE_LIBDEFLATE
 
+void LIBNBT_count_zlib_inflate(size_t srcsize, size_t length, int grown) {
+    LIBNBT_ATOMIC_ADD(&LIBNBT_inflate_stats.calls, 1);
+    LIBNBT_ATOMIC_ADD(&LIBNBT_inflate_stats.retries, grown);
+    LIBNBT_ATOMIC_ADD(&LIBNBT_inflate_stats.bytes_in, srcsize);
+    LIBNBT_ATOMIC_ADD(&LIBNBT_inflate_stats.bytes_out, length);
+}
+
 int LIBNBT_decompress_gzip(uint8_t** dest, size_t* destsize, uint8_t* src, size_t srcsize) {
 
     size_t sizestep = 1 << 16;
@@ -760,6 +1151,7 @@ int LIBNBT_decompress_gzip(uint8_t** dest, size_t* destsize, uint8_t* src, size_
     inflateEnd (&strm);
     *destsize = sizecur - strm.avail_out;
     *dest = buffer;
+    LIBNBT_count_zlib_inflate(srcsize, *destsize, sizecur > sizestep);
     return 0;
 }
 
@@ -800,9 +1192,13 @@ int LIBNBT_decompress_zlib(uint8_t** dest, size_t* destsize, uint8_t* src, size_
     inflateEnd (&strm);
     *destsize = sizecur - strm.avail_out;
     *dest = buffer;
+    LIBNBT_count_zlib_inflate(srcsize, *destsize, sizecur > sizestep);
     return 0;
 }
 
+void NBT_Release_Thread(void) {
+}
+
 int LIBNBT_compress_gzip(uint8_t* dest, size_t* destsize, uint8_t* src, size_t srcsize) {
     z_stream strm;
     strm.zalloc = Z_NULL;
@@ -830,74 +1226,90 @@ int LIBNBT_compress_gzip(uint8_t* dest, size_t* destsize, uint8_t* src, size_t s
 
 #else
 
-int LIBNBT_decompress_gzip(uint8_t** dest, size_t* destsize, uint8_t* src, size_t srcsize) {
-    struct libdeflate_decompressor * decompressor;
-    decompressor = libdeflate_alloc_decompressor();
-    size_t sizestep = 1 << 20;
-    size_t sizecur = sizestep;
-    uint8_t* buffer = malloc(sizecur);
+// Each thread keeps its decompressor, allocating one costs more than
+// inflating a small chunk. The output buffer is sized from the largest
+// output seen lately, which decays slowly so one huge chunk doesn't make
+// every later buffer huge too.
+static LIBNBT_THREAD_LOCAL struct libdeflate_decompressor* LIBNBT_decompressor = NULL;
+static LIBNBT_THREAD_LOCAL size_t LIBNBT_size_hint = 0;
 
-    enum libdeflate_result result;
-    size_t length;
+typedef enum libdeflate_result (*LIBNBT_inflate_fn)(struct libdeflate_decompressor*, const void*, size_t, void*, size_t, size_t*);
 
-    while(1) {
-        result = libdeflate_gzip_decompress(decompressor, src, srcsize, buffer, sizecur, &length);
-        if (result == LIBDEFLATE_SUCCESS) {
-            libdeflate_free_decompressor(decompressor);
-            uint8_t* result = realloc(buffer, length);
-            if (result == NULL) {
-                free(buffer);
-                return -1;
-            }
-            *dest = result;
-            *destsize = length;
-            return 0;
-        } else if (result == LIBDEFLATE_INSUFFICIENT_SPACE) {
-            sizecur += sizestep;
-            free(buffer);
-            buffer = malloc(sizecur);
-            continue;
-        } else {
-            free(buffer);
-            libdeflate_free_decompressor(decompressor);
+int LIBNBT_inflate(LIBNBT_inflate_fn inflate, size_t expected, uint8_t** dest, size_t* destsize, uint8_t* src, size_t srcsize) {
+    if (LIBNBT_decompressor == NULL) {
+        LIBNBT_decompressor = libdeflate_alloc_decompressor();
+        if (LIBNBT_decompressor == NULL) {
+            LIBNBT_ATOMIC_ADD(&LIBNBT_inflate_stats.failures, 1);
             return -1;
         }
     }
-}
 
-int LIBNBT_decompress_zlib(uint8_t** dest, size_t* destsize, uint8_t* src, size_t srcsize) {
-    struct libdeflate_decompressor * decompressor;
-    decompressor = libdeflate_alloc_decompressor();
-    size_t sizestep = 1 << 20;
-    size_t sizecur = sizestep;
-    uint8_t* buffer = malloc(sizecur);
+    // Deflate can't do better than about 1:1032, anything claiming more is corrupt
+    if (expected > srcsize * LIBNBT_MAX_RATIO) {
+        expected = 0;
+    }
+    size_t sizecur = expected ? expected : LIBNBT_size_hint + LIBNBT_size_hint / 8;
+    if (sizecur < LIBNBT_MIN_INFLATE) {
+        sizecur = LIBNBT_MIN_INFLATE;
+    }
 
-    enum libdeflate_result result;
-    size_t length;
+    int retried = 0;
+    while (1) {
+        uint8_t* buffer = malloc(sizecur);
+        if (buffer == NULL) {
+            break;
+        }
 
-    while(1) {
-        result = libdeflate_zlib_decompress(decompressor, src, srcsize, buffer, sizecur, &length);
+        size_t length;
+        enum libdeflate_result result = inflate(LIBNBT_decompressor, src, srcsize, buffer, sizecur, &length);
         if (result == LIBDEFLATE_SUCCESS) {
-            libdeflate_free_decompressor(decompressor);
-            uint8_t* result = realloc(buffer, length);
-            if (result == NULL) {
-                free(buffer);
-                return -1;
+            if (length > LIBNBT_size_hint) {
+                LIBNBT_size_hint = length;
+            } else {
+                LIBNBT_size_hint -= (LIBNBT_size_hint - length) / 16;
             }
-            *dest = result;
+            LIBNBT_ATOMIC_ADD(&LIBNBT_inflate_stats.calls, 1);
+            LIBNBT_ATOMIC_ADD(&LIBNBT_inflate_stats.retries, retried);
+            LIBNBT_ATOMIC_ADD(&LIBNBT_inflate_stats.bytes_in, srcsize);
+            LIBNBT_ATOMIC_ADD(&LIBNBT_inflate_stats.bytes_out, length);
+            *dest = buffer;
             *destsize = length;
             return 0;
-        } else if (result == LIBDEFLATE_INSUFFICIENT_SPACE) {
-            sizecur += sizestep;
-            free(buffer);
-            buffer = malloc(sizecur);
-            continue;
-        } else {
-            free(buffer);
-            libdeflate_free_decompressor(decompressor);
-            return -1;
         }
+
+        free(buffer);
+        if (result != LIBDEFLATE_INSUFFICIENT_SPACE || sizecur >= srcsize * LIBNBT_MAX_RATIO) {
+            break;
+        }
+        // Guessed too small: start over with twice the room
+        sizecur *= 2;
+        retried = 1;
+    }
+
+    LIBNBT_ATOMIC_ADD(&LIBNBT_inflate_stats.failures, 1);
+    return -1;
+}
+
+int LIBNBT_decompress_gzip(uint8_t** dest, size_t* destsize, uint8_t* src, size_t srcsize) {
+    // The trailer holds the uncompressed size modulo 2^32
+    size_t expected = 0;
+    if (srcsize >= 18) {
+        const uint8_t* trailer = src + srcsize - 4;
+        expected = (size_t)trailer[0] | ((size_t)trailer[1] << 8) | ((size_t)trailer[2] << 16) | ((size_t)trailer[3] << 24);
+    }
+    return LIBNBT_inflate(libdeflate_gzip_decompress, expected, dest, destsize, src, srcsize);
+}
+
+int LIBNBT_decompress_zlib(uint8_t** dest, size_t* destsize, uint8_t* src, size_t srcsize) {
+    return LIBNBT_inflate(libdeflate_zlib_decompress, 0, dest, destsize, src, srcsize);
+}
+
+void NBT_Release_Thread(void) {
+    if (LIBNBT_decompressor != NULL) {
+        libdeflate_free_decompressor(LIBNBT_decompressor);
+        LIBNBT_decompressor = NULL;
     }
+    LIBNBT_size_hint = 0;
 }
 
 int LIBNBT_compress_gzip(uint8_t* dest, size_t* destsize, uint8_t* src, size_t srcsize) {
@@ -942,13 +1354,42 @@ int NBT_toSNBT(NBT* root, char* buff, size_t* bufflen) {
     return NBT_toSNBT_Opt(root, buff, bufflen, -1, -1, NULL);
 }
 
+uint32_t NBT_Hash_Key(const char* key) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    if (key) {
+        while (*key) {
+            hash = (hash ^ (uint8_t)*key++) * 16777619u;
+        }
+    }
+    return hash;
+}
+
 NBT* NBT_GetChild(NBT* root, const char* key) {
     if (root == NULL || root->type != TAG_Compound || root->child == NULL) {
         return NULL;
     }
+    return NBT_GetChild_Hashed(root, key, root->index ? NBT_Hash_Key(key) : 0);
+}
+
+NBT* NBT_GetChild_Hashed(NBT* root, const char* key, uint32_t hash) {
+    if (root == NULL || root->type != TAG_Compound || root->child == NULL) {
+        return NULL;
+    }
+    if (root->index) {
+        NBT_Index* index = root->index;
+        uint32_t i = hash & index->mask;
+        while (index->slots[i].node) {
+            if (index->slots[i].hash == hash && LIBNBT_key_equals(index->slots[i].node->key, key)) {
+                return index->slots[i].node;
+            }
+            i = (i + 1) & index->mask;
+        }
+        return NULL;
+    }
     NBT* child = root->child;
     while(child) {
-        if (!strcmp(child->key, key)) {
+        if (LIBNBT_key_equals(child->key, key)) {
             return child;
         }
         child = child->next;
@@ -956,6 +1397,37 @@ NBT* NBT_GetChild(NBT* root, const char* key) {
     return NULL;
 }
 
+int NBT_Reindex(NBT* compound) {
+    if (compound == NULL || compound->type != TAG_Compound) {
+        return LIBNBT_ERROR_INTERNAL;
+    }
+
+    // An arena tree's old index stays in the arena until the tree goes
+    int arena = compound->flags & LIBNBT_FLAG_ARENA;
+    if (!arena) {
+        free(compound->index);
+    }
+    compound->index = NULL;
+
+    uint32_t count = 0;
+    NBT* child;
+    for (child = compound->child; child; child = child->next) {
+        count++;
+    }
+    if (count < NBT_INDEX_MIN) {
+        return 0;
+    }
+
+    size_t size = LIBNBT_index_size(count);
+    NBT_Index* index = arena ? LIBNBT_arena_alloc(LIBNBT_tree_arena(compound), size) : malloc(size);
+    if (index == NULL) {
+        return LIBNBT_ERROR_INTERNAL;
+    }
+    LIBNBT_index_fill(index, compound, count);
+    compound->index = index;
+    return 0;
+}
+
 NBT* NBT_GetChild_Deep(NBT* root, ...) {
     va_list va;
     va_start(va, root);
@@ -972,93 +1444,425 @@ NBT* NBT_GetChild_Deep(NBT* root, ...) {
     return current;
 }
 
-NBT* NBT_Parse_Opt(uint8_t* data, size_t length, NBT_Error* errid) {
+uint32_t LIBNBT_read_be32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+// Bytes of one element, 0 for types whose size isn't fixed
+size_t LIBNBT_fixed_size(uint8_t type) {
+    switch (type) {
+        case TAG_Byte: return 1;
+        case TAG_Short: return 2;
+        case TAG_Int: case TAG_Float: return 4;
+        case TAG_Long: case TAG_Double: return 8;
+        default: return 0;
+    }
+}
 
-    NBT_Buffer* buffer;
+int NBT_Reader_Init(NBT_Reader* reader, uint8_t* data, size_t length, NBT_Error* errid) {
+    reader->data = data;
+    reader->len = length;
+    reader->pos = 0;
+    reader->owned = NULL;
+    reader->depth = 0;
+    reader->started = 0;
+
+    int ret = 0;
+    if (length > 1 && data[0] == 0x1f && data[1] == 0x8b) {
+        ret = LIBNBT_decompress_gzip(&reader->owned, &reader->len, data, length);
+    } else if (length > 0 && data[0] == 0x78) {
+        ret = LIBNBT_decompress_zlib(&reader->owned, &reader->len, data, length);
+    }
+    if (ret != 0) {
+        reader->owned = NULL;
+        reader->len = 0;
+        LIBNBT_fill_err(errid, LIBNBT_ERROR_UNZIP_ERROR, 0);
+        return LIBNBT_ERROR_UNZIP_ERROR;
+    }
+    if (reader->owned) {
+        reader->data = reader->owned;
+    }
+    LIBNBT_fill_err(errid, 0, 0);
+    return 0;
+}
+
+void NBT_Reader_Free(NBT_Reader* reader) {
+    free(reader->owned);
+    reader->owned = NULL;
+    reader->data = NULL;
+    reader->len = 0;
+}
+
+int NBT_Token_Is(const NBT_Token* token, const char* key) {
+    size_t len = strlen(key);
+    return token->key_len == len && memcmp(token->key, key, len) == 0;
+}
+
+int LIBNBT_reader_payload(NBT_Reader* reader, NBT_Token* token) {
+    const uint8_t* p = reader->data + reader->pos;
+    size_t left = reader->len - reader->pos;
+    size_t size = LIBNBT_fixed_size(token->type);
+
+    if (size) {
+        if (left < size) {
+            return LIBNBT_ERROR_EARLY_EOF;
+        }
+        uint64_t value = 0;
+        size_t i;
+        for (i = 0; i < size; i++) {
+            value = (value << 8) | p[i];
+        }
+        switch (token->type) {
+            case TAG_Byte: token->value_i = (int8_t)value; break;
+            case TAG_Short: token->value_i = (int16_t)value; break;
+            case TAG_Int: token->value_i = (int32_t)value; break;
+            case TAG_Long: token->value_i = (int64_t)value; break;
+            case TAG_Float: {
+                uint32_t bits = (uint32_t)value;
+                float f;
+                memcpy(&f, &bits, sizeof(f));
+                token->value_d = f;
+                break;
+            }
+            default: {
+                double d;
+                memcpy(&d, &value, sizeof(d));
+                token->value_d = d;
+                break;
+            }
+        }
+        reader->pos += size;
+        return 0;
+    }
+
+    switch (token->type) {
+        case TAG_String: {
+            if (left < 2) {
+                return LIBNBT_ERROR_EARLY_EOF;
+            }
+            size_t len = ((size_t)p[0] << 8) | p[1];
+            if (left - 2 < len) {
+                return LIBNBT_ERROR_EARLY_EOF;
+            }
+            token->data = p + 2;
+            token->len = (int32_t)len;
+            reader->pos += 2 + len;
+            return 0;
+        }
+        case TAG_Byte_Array:
+        case TAG_Int_Array:
+        case TAG_Long_Array: {
+            if (left < 4) {
+                return LIBNBT_ERROR_EARLY_EOF;
+            }
+            int32_t count = (int32_t)LIBNBT_read_be32(p);
+            size_t element = token->type == TAG_Byte_Array ? 1 : (token->type == TAG_Int_Array ? 4 : 8);
+            if (count < 0) {
+                return LIBNBT_ERROR_INVALID_DATA;
+            }
+            if ((left - 4) / element < (size_t)count) {
+                return LIBNBT_ERROR_EARLY_EOF;
+            }
+            token->data = p + 4;
+            token->len = count;
+            reader->pos += 4 + (size_t)count * element;
+            return 0;
+        }
+        case TAG_List:
+        case TAG_Compound: {
+            if (reader->depth >= NBT_READER_MAX_DEPTH) {
+                return LIBNBT_ERROR_INVALID_DATA;
+            }
+            uint32_t count = 0;
+            uint8_t list_type = TAG_End;
+            if (token->type == TAG_List) {
+                if (left < 5) {
+                    return LIBNBT_ERROR_EARLY_EOF;
+                }
+                list_type = p[0];
+                int32_t len = (int32_t)LIBNBT_read_be32(p + 1);
+                if (len < 0 || list_type > TAG_Long_Array || (list_type == TAG_End && len != 0)) {
+                    return LIBNBT_ERROR_INVALID_DATA;
+                }
+                count = (uint32_t)len;
+                reader->pos += 5;
+            }
+            token->len = (int32_t)count;
+            token->list_type = list_type;
+            reader->stack[reader->depth].type = token->type;
+            reader->stack[reader->depth].list_type = list_type;
+            reader->stack[reader->depth].remaining = count;
+            reader->depth++;
+            return 0;
+        }
+        default:
+            return LIBNBT_ERROR_INVALID_DATA;
+    }
+}
+
+int NBT_Reader_Next(NBT_Reader* reader, NBT_Token* token) {
+    memset(token, 0, sizeof(NBT_Token));
+
+    if (reader->started && reader->depth == 0) {
+        return 0;
+    }
+
+    int named = 1;
+    if (reader->depth > 0 && reader->stack[reader->depth - 1].type == TAG_List) {
+        // List elements have neither a type byte nor a name
+        if (reader->stack[reader->depth - 1].remaining == 0) {
+            reader->depth--;
+            token->type = TAG_End;
+            return 1;
+        }
+        reader->stack[reader->depth - 1].remaining--;
+        token->type = reader->stack[reader->depth - 1].list_type;
+        named = 0;
+    } else {
+        if (reader->pos >= reader->len) {
+            return LIBNBT_ERROR_EARLY_EOF;
+        }
+        uint8_t type = reader->data[reader->pos++];
+        if (type == TAG_End) {
+            if (reader->depth == 0) {
+                return LIBNBT_ERROR_INVALID_DATA;
+            }
+            reader->depth--;
+            token->type = TAG_End;
+            return 1;
+        }
+        if (!isValidTag(type)) {
+            return LIBNBT_ERROR_INVALID_DATA;
+        }
+        token->type = type;
+    }
+    reader->started = 1;
+
+    if (named) {
+        if (reader->len - reader->pos < 2) {
+            return LIBNBT_ERROR_EARLY_EOF;
+        }
+        size_t len = ((size_t)reader->data[reader->pos] << 8) | reader->data[reader->pos + 1];
+        if (reader->len - reader->pos - 2 < len) {
+            return LIBNBT_ERROR_EARLY_EOF;
+        }
+        token->key = (const char*)reader->data + reader->pos + 2;
+        token->key_len = (uint16_t)len;
+        reader->pos += 2 + len;
+    }
+
+    int ret = LIBNBT_reader_payload(reader, token);
+    return ret ? ret : 1;
+}
+
+int NBT_Reader_Skip(NBT_Reader* reader) {
+    int target = reader->depth - 1;
+    if (target < 0) {
+        return 0;
+    }
+
+    NBT_Token token;
+    while (reader->depth > target) {
+        // The rest of a list of numbers is one jump
+        if (reader->stack[reader->depth - 1].type == TAG_List) {
+            size_t size = LIBNBT_fixed_size(reader->stack[reader->depth - 1].list_type);
+            uint32_t remaining = reader->stack[reader->depth - 1].remaining;
+            if (size && remaining) {
+                if ((reader->len - reader->pos) / size < remaining) {
+                    return LIBNBT_ERROR_EARLY_EOF;
+                }
+                reader->pos += size * remaining;
+                reader->stack[reader->depth - 1].remaining = 0;
+            }
+        }
+
+        int ret = NBT_Reader_Next(reader, &token);
+        if (ret < 0) {
+            return ret;
+        }
+        if (ret == 0) {
+            break;
+        }
+    }
+    return 0;
+}
+
+NBT* LIBNBT_parse(uint8_t* data, size_t length, NBT_Error* errid, int use_arena, int borrow) {
+
+    NBT_Buffer buffer;
+    buffer.data = data;
+    buffer.len = length;
+    buffer.pos = 0;
+    buffer.arena = NULL;
+    buffer.borrow = borrow;
 
     if (length > 1 && data[0] == 0x1f && data[1] == 0x8b) {
         // file is gzip
-        size_t size;
-        uint8_t* undata;
-        int ret = LIBNBT_decompress_gzip(&undata, &size, data, length);
+        int ret = LIBNBT_decompress_gzip(&buffer.data, &buffer.len, data, length);
         if (ret != 0) {
             LIBNBT_fill_err(errid, LIBNBT_ERROR_UNZIP_ERROR, 0);
             return NULL;
         }
-        buffer = LIBNBT_init_buffer(undata, size);
-    } else if (data[0] == 0x78) {
+    } else if (length > 0 && data[0] == 0x78) {
         // file is zlib
-        size_t size;
-        uint8_t* undata;
-        int ret = LIBNBT_decompress_zlib(&undata, &size, data, length);
+        int ret = LIBNBT_decompress_zlib(&buffer.data, &buffer.len, data, length);
         if (ret != 0) {
             LIBNBT_fill_err(errid, LIBNBT_ERROR_UNZIP_ERROR, 0);
             return NULL;
         }
-        buffer = LIBNBT_init_buffer(undata, size);
+    }
+
+    NBT* root;
+    if (use_arena) {
+        // Arrays are copied out and every tag costs a node on top, so the
+        // first block fits most trees with half the input again to spare.
+        // Borrowed arrays stay where they are, leaving nodes and keys.
+        size_t size = borrow ? buffer.len / 2 : buffer.len + buffer.len / 2;
+        buffer.arena = LIBNBT_arena_create(size + sizeof(NBT));
+        root = buffer.arena ? LIBNBT_alloc_NBT(&buffer, TAG_End) : NULL;
+        if (root) {
+            root->flags |= LIBNBT_FLAG_ARENA_ROOT;
+        }
     } else {
-        buffer = LIBNBT_init_buffer(data, length);
+        root = LIBNBT_create_NBT(TAG_End);
     }
 
-    NBT* root = LIBNBT_create_NBT(TAG_End);
-    int ret = LIBNBT_parse_value(root, buffer, 0);
-    if (buffer->data != data) {
-        free(buffer->data);
+    int ret = LIBNBT_ERROR_INTERNAL;
+    if (root) {
+        ret = LIBNBT_parse_value(root, &buffer, 0);
+    }
+    if (buffer.data != data) {
+        // A borrowed tree keeps pointing into what was inflated
+        if (borrow && buffer.arena) {
+            buffer.arena->input = buffer.data;
+        } else {
+            free(buffer.data);
+        }
     }
 
     if (ret != 0) {
-        LIBNBT_fill_err(errid, ret, buffer->pos);
-        NBT_Free(root);
-        free(buffer);
+        LIBNBT_fill_err(errid, ret, buffer.pos);
+        if (root) {
+            NBT_Free(root);
+        } else {
+            LIBNBT_arena_free(buffer.arena);
+        }
         return NULL;
     } else {
-        if (buffer->pos != buffer->len) {
-            LIBNBT_fill_err(errid, LIBNBT_ERROR_LEFTOVER_DATA, buffer->pos);
+        if (buffer.pos != buffer.len) {
+            LIBNBT_fill_err(errid, LIBNBT_ERROR_LEFTOVER_DATA, buffer.pos);
         } else {
-            LIBNBT_fill_err(errid, 0, buffer->pos);
+            LIBNBT_fill_err(errid, 0, buffer.pos);
         }
-        free(buffer);
         return root;
     }
 }
 
+NBT* NBT_Parse_Opt(uint8_t* data, size_t length, NBT_Error* errid) {
+    return LIBNBT_parse(data, length, errid, 0, 0);
+}
+
+NBT* NBT_Parse_Arena(uint8_t* data, size_t length, NBT_Error* errid) {
+    return LIBNBT_parse(data, length, errid, 1, 0);
+}
+
+NBT* NBT_Parse_Borrowed(uint8_t* data, size_t length, NBT_Error* errid) {
+    return LIBNBT_parse(data, length, errid, 1, 1);
+}
+
+int32_t NBT_Get_Int(const NBT* array, int32_t index) {
+    uint32_t value;
+    memcpy(&value, (const uint8_t*)array->value_a.value + (size_t)index * 4, 4);
+    return (int32_t)((array->flags & LIBNBT_FLAG_BIG_ENDIAN) ? bswap_32(value) : value);
+}
+
+int64_t NBT_Get_Long(const NBT* array, int32_t index) {
+    uint64_t value;
+    memcpy(&value, (const uint8_t*)array->value_a.value + (size_t)index * 8, 8);
+    return (int64_t)((array->flags & LIBNBT_FLAG_BIG_ENDIAN) ? bswap_64(value) : value);
+}
+
+void* NBT_Get_Array(NBT* array) {
+    if (!(array->flags & LIBNBT_FLAG_BIG_ENDIAN)) {
+        return array->value_a.value;
+    }
+
+    // The swapped copy goes into the arena of the tree the node is in
+    LIBNBT_Arena* arena = LIBNBT_tree_arena(array);
+
+    int width = array->type == TAG_Int_Array ? 4 : 8;
+    void* value = LIBNBT_arena_alloc(arena, (size_t)array->value_a.len * width);
+    if (value == NULL) {
+        return NULL;
+    }
+    LIBNBT_swap(value, array->value_a.value, array->value_a.len, width);
+    array->value_a.value = value;
+    array->flags &= ~(LIBNBT_FLAG_BORROWED | LIBNBT_FLAG_BIG_ENDIAN);
+    return array->value_a.value;
+}
+
 NBT* NBT_Parse(uint8_t* data, size_t length) {
     return NBT_Parse_Opt(data, length, NULL);
 }
 
 void NBT_Free(NBT* root) {
-    if (root->key != NULL) {
-        free(root->key);
+    if (root == NULL) {
+        return;
     }
-    switch (root->type) {
-        case TAG_Byte_Array:
-        case TAG_Long_Array:
-        case TAG_Int_Array:
-        case TAG_String:
-        if (root->value_a.value != NULL) {
-            free(root->value_a.value);
+
+    // An arena tree goes all at once; its other nodes aren't freed alone
+    if (root->flags & LIBNBT_FLAG_ARENA) {
+        if (root->flags & LIBNBT_FLAG_ARENA_ROOT) {
+            LIBNBT_arena_free((LIBNBT_Arena*)((uint8_t*)root - LIBNBT_ARENA_HEADER));
         }
-        break;
+        return;
+    }
 
-        case TAG_List:
-        case TAG_Compound:
-        if (root->child != NULL) {
-            NBT_Free(root->child);
+    // The node goes with all its siblings and everything below them.
+    // Children are spliced into the sibling chain right after their parent,
+    // so one walk along next reaches every node without recursing, however
+    // deep or long the tree is.
+    NBT* current = root;
+    while (current->prev) {
+        current = current->prev;
+    }
+
+    while (current) {
+        switch (current->type) {
+            case TAG_Byte_Array:
+            case TAG_Long_Array:
+            case TAG_Int_Array:
+            case TAG_String:
+            if (current->value_a.value != NULL) {
+                free(current->value_a.value);
+            }
+            break;
+
+            case TAG_List:
+            case TAG_Compound:
+            if (current->type == TAG_Compound) {
+                free(current->index);
+            }
+            if (current->child != NULL) {
+                NBT* last = current->child;
+                while (last->next) {
+                    last = last->next;
+                }
+                last->next = current->next;
+                current->next = current->child;
+            }
+            break;
+
+            default: break;
         }
 
-        default: break;
-    }
-    if (root->prev) {
-        root->prev->next = NULL;
-        NBT_Free(root->prev);
-        root->prev = NULL;
-    }
-    if (root->next) {
-        root->next->prev = NULL;
-        NBT_Free(root->next);
-        root->next = NULL;
+        NBT* next = current->next;
+        if (current->key != NULL) {
+            free(current->key);
+        }
+        free(current);
+        current = next;
     }
-    free(root);
 }
 
 int LIBNBT_nbt_write_key(NBT_Buffer* buffer, char* key, int type) {
@@ -1123,39 +1927,25 @@ int LIBNBT_nbt_write_array(NBT_Buffer* buffer, void* value, int32_t len, char* k
     if (!ret) {
         return LIBNBT_ERROR_BUFFER_OVERFLOW;
     }
+    size_t width;
     switch(type) {
-        case TAG_Byte_Array: {
-            int i;
-            for (i = 0; i < len; i ++) {
-                ret = LIBNBT_writeUint8(buffer, ((uint8_t*)value)[i]);
-                if (!ret) {
-                    return LIBNBT_ERROR_BUFFER_OVERFLOW;
-                }
-            }
-        }
-        break;
-        case TAG_Int_Array: {
-            int i;
-            for (i = 0; i < len; i ++) {
-                ret = LIBNBT_writeUint32(buffer, ((uint32_t*)value)[i]);
-                if (!ret) {
-                    return LIBNBT_ERROR_BUFFER_OVERFLOW;
-                }
-            }
-        }
-        break;
-        case TAG_Long_Array: {
-            int i;
-            for (i = 0; i < len; i ++) {
-                ret = LIBNBT_writeUint64(buffer, ((uint64_t*)value)[i]);
-                if (!ret) {
-                    return LIBNBT_ERROR_BUFFER_OVERFLOW;
-                }
-            }
-        }
-        break;
+        case TAG_Byte_Array: width = 1; break;
+        case TAG_Int_Array: width = 4; break;
+        case TAG_Long_Array: width = 8; break;
         default: return LIBNBT_ERROR_INTERNAL;
     }
+    if (len < 0 || (size_t)len > (buffer->len - buffer->pos) / width) {
+        return LIBNBT_ERROR_BUFFER_OVERFLOW;
+    }
+    if (len == 0) {
+        return 0;
+    }
+    if (width == 1) {
+        memcpy(buffer->data + buffer->pos, value, len);
+    } else {
+        LIBNBT_swap(buffer->data + buffer->pos, value, len, (int)width);
+    }
+    buffer->pos += len * width;
     return 0;
 }
 
@@ -1254,6 +2044,7 @@ int LIBNBT_nbt_write_nbt(NBT_Buffer* buffer, NBT* root, int writekey) {
         case TAG_Byte_Array:
         case TAG_Int_Array:
         case TAG_Long_Array:
+        if (NBT_Get_Array(root) == NULL && root->value_a.len) return LIBNBT_ERROR_INTERNAL;
         ret = LIBNBT_nbt_write_array(buffer, root->value_a.value, root->value_a.len, root->key, root->type);
         if (ret) return ret;
         return 0;
@@ -1388,14 +2179,19 @@ int MCA_ReadRaw_File(FILE* fp, MCA* mca, int skip_chunk_error) {
 
     uint64_t offsets[CHUNKS_IN_REGION];
 
+    // Both header tables in one read: locations, then timestamps
+    uint8_t header[8192];
+    if (fread(header, 1, sizeof(header), fp) != sizeof(header)) {
+        return LIBNBT_ERROR_EARLY_EOF;
+    }
+
     int j;
     for (j = 0; j < CHUNKS_IN_REGION; j ++) {
-        uint64_t t = fgetc(fp) << 16;
-        t |= fgetc(fp) << 8;
-        t |= fgetc(fp);
+        uint8_t* entry = header + j * 4;
+        uint64_t t = ((uint64_t)entry[0] << 16) | ((uint64_t)entry[1] << 8) | entry[2];
         offsets[j] = t << 12;
-        uint64_t tsize = (fgetc(fp) << 12) + offsets[j];
-        if (tsize > size) {
+        uint64_t tsize = ((uint64_t)entry[3] << 12) + offsets[j];
+        if (tsize > (uint64_t)size) {
             if (skip_chunk_error) {
                 offsets[j] = 0;
             } else {
@@ -1405,11 +2201,8 @@ int MCA_ReadRaw_File(FILE* fp, MCA* mca, int skip_chunk_error) {
     }
 
     for (j = 0; j < CHUNKS_IN_REGION; j ++) {
-        uint64_t t = fgetc(fp) << 24;
-        t |= fgetc(fp) << 16;
-        t |= fgetc(fp) << 8;
-        t |= fgetc(fp);
-        mca->epoch[j] = t;
+        uint8_t* entry = header + 4096 + j * 4;
+        mca->epoch[j] = ((uint32_t)entry[0] << 24) | ((uint32_t)entry[1] << 16) | ((uint32_t)entry[2] << 8) | entry[3];
     }
 
     for (j = 0; j < CHUNKS_IN_REGION; j ++) {
@@ -1418,13 +2211,19 @@ int MCA_ReadRaw_File(FILE* fp, MCA* mca, int skip_chunk_error) {
             continue;
         }
 
+        uint8_t chunk_header[5];
         fseek(fp, offsets[j], SEEK_SET);
-        uint32_t tsize = fgetc(fp) << 24;
-        tsize |= fgetc(fp) << 16;
-        tsize |= fgetc(fp) << 8;
-        tsize |= fgetc(fp);
+        if (fread(chunk_header, 1, sizeof(chunk_header), fp) != sizeof(chunk_header)) {
+            if (skip_chunk_error) continue;
+            else goto chunk_error;
+        }
+        uint32_t tsize = ((uint32_t)chunk_header[0] << 24) | ((uint32_t)chunk_header[1] << 16) | ((uint32_t)chunk_header[2] << 8) | chunk_header[3];
+        if (tsize < 1 || offsets[j] + 4 + tsize > (uint64_t)size) {
+            if (skip_chunk_error) continue;
+            else goto chunk_error;
+        }
 
-        uint8_t type = fgetc(fp);
+        uint8_t type = chunk_header[4];
         if (type != 2 && !skip_chunk_error) {
             goto chunk_error;
         }
@@ -47,12 +47,18 @@ typedef enum NBT_Compression {
 // There's always 1024 (32*32) chunks in a region file
 #define CHUNKS_IN_REGION 1024
 
+// Compounds with fewer children are searched one by one
+#define NBT_INDEX_MIN 8
+
 // NBT data structure
 typedef struct NBT {
 
     // NBT tag. see the enum above
     enum NBT_Tags type;
 
+    // How the node was allocated, set by the parser; leave it alone
+    uint8_t flags;
+
     // NBT tag name. Nullable when no name defined. '\0' ended
     char* key;
 
@@ -67,13 +73,20 @@ typedef struct NBT {
 
         // Array data, used when tag=[TAG_Byte_Array, TAG_Int_Array, TAG_Long_Array, TAG_String]
         // Note: when using TAG_String, value_a.len equals 1 + string length, because of the ending '\0'
+        // Note: in a tree from NBT_Parse_Borrowed strings have no ending '\0', and int and
+        // long arrays are read through NBT_Get_Int, NBT_Get_Long or NBT_Get_Array
         struct {
             void* value;
             int32_t len;
         }value_a;
 
-        // pointer to child. used when tag=[TAG_Compound, TAG_List]
-        struct NBT *child;
+        // used when tag=[TAG_Compound, TAG_List]
+        struct {
+            // pointer to child
+            struct NBT *child;
+            // hash table over the children of a large compound, NULL otherwise
+            struct NBT_Index *index;
+        };
     };
 
     // if this NBT tag is inside a list or compound, these two links are used to denote its siblings
@@ -104,12 +117,91 @@ typedef struct NBT_Error {
     int position;
 } NBT_Error;
 
+// Inflate counters of all threads since start
+typedef struct NBT_Inflate_Stats {
+    // successful inflates
+    uint64_t calls;
+    // inflates whose first output buffer was too small, so they ran again
+    uint64_t retries;
+    // corrupt input or out of memory
+    uint64_t failures;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+} NBT_Inflate_Stats;
+
+// Deepest nesting the pull reader follows, the same limit the game has
+#define NBT_READER_MAX_DEPTH 512
+
+// One tag as seen by the pull reader. Everything points into the reader's
+// buffer and stays valid until NBT_Reader_Free.
+typedef struct NBT_Token {
+    // TAG_End closes the compound or list entered last
+    enum NBT_Tags type;
+
+    // Tag name, not '\0' ended; key_len is 0 for list elements
+    const char* key;
+    uint16_t key_len;
+
+    // TAG_Byte to TAG_Long; TAG_Float and TAG_Double go to value_d
+    int64_t value_i;
+    double value_d;
+
+    // Payload of arrays and strings as stored: int and long elements are
+    // still big endian, strings aren't '\0' ended
+    const uint8_t* data;
+
+    // Elements of arrays and lists, bytes of strings
+    int32_t len;
+
+    // Element type of a TAG_List
+    enum NBT_Tags list_type;
+} NBT_Token;
+
+typedef struct NBT_Reader {
+    const uint8_t* data;
+    size_t len;
+    size_t pos;
+    // inflated copy of the input, NULL when it wasn't compressed
+    uint8_t* owned;
+    int depth;
+    int started;
+    struct {
+        uint8_t type;
+        uint8_t list_type;
+        uint32_t remaining;
+    } stack[NBT_READER_MAX_DEPTH];
+} NBT_Reader;
+
 NBT*  NBT_Parse(uint8_t* data, size_t length);
 NBT*  NBT_Parse_Opt(uint8_t* data, size_t length, NBT_Error* err);
+// Like NBT_Parse_Opt, but the whole tree, keys and arrays included, is
+// carved out of a few large blocks. NBT_Free on the returned root releases
+// all of them at once; nodes of such a tree can't be freed, or moved to
+// another tree, on their own.
+NBT*  NBT_Parse_Arena(uint8_t* data, size_t length, NBT_Error* err);
+// Like NBT_Parse_Arena, but arrays and strings aren't copied: value_a points
+// into data, which has to outlive the tree unless it was compressed (the
+// inflated copy is then freed with the tree). Int and long arrays are left
+// big endian and unaligned until NBT_Get_Array swaps a copy of them.
+NBT*  NBT_Parse_Borrowed(uint8_t* data, size_t length, NBT_Error* err);
 void  NBT_Free(NBT* root);
 int   NBT_Pack(NBT* root, uint8_t* buffer, size_t* length);
 int   NBT_Pack_Opt(NBT* root, uint8_t* buffer, size_t* length, NBT_Compression compression, NBT_Error* errid);
 NBT*  NBT_GetChild(NBT* root, const char* key);
+// Compounds of NBT_INDEX_MIN children or more are indexed when parsed, so
+// looking up a child doesn't walk them all. The hash of a key used again
+// and again can be worked out once with NBT_Hash_Key.
+uint32_t NBT_Hash_Key(const char* key);
+NBT*  NBT_GetChild_Hashed(NBT* root, const char* key, uint32_t hash);
+// Builds the index of a compound again, or drops it when it's too small;
+// call after adding or removing children of an indexed compound by hand
+int   NBT_Reindex(NBT* compound);
+// Element of a TAG_Int_Array or TAG_Long_Array, borrowed or not
+int32_t NBT_Get_Int(const NBT* array, int32_t index);
+int64_t NBT_Get_Long(const NBT* array, int32_t index);
+// The elements of an array in host order; a borrowed int or long array is
+// swapped into a copy the first time. Not thread safe on borrowed trees.
+void* NBT_Get_Array(NBT* array);
 NBT*  NBT_GetChild_Deep(NBT* root, ...);
 int   NBT_toSNBT(NBT* root, char* buff, size_t* bufflen);
 int   NBT_toSNBT_Opt(NBT* root, char* buff, size_t* bufflen, int maxlevel, int space, NBT_Error* errid);
@@ -120,6 +212,22 @@ int   MCA_ReadRaw_File(FILE* fp, MCA* mca, int skip_chunk_error);
 int   MCA_WriteRaw_File(FILE* fp, MCA* mca);
 int   MCA_ParseAll(MCA* mca);
 void  MCA_Free(MCA* mca);
+// Pull reader: walks the data tag by tag without building a tree or
+// allocating, apart from inflating compressed input. Next returns 1 with a
+// token, 0 once the root tag is done, or an error code. A compound or list
+// token enters it; its children follow, then a TAG_End token.
+int   NBT_Reader_Init(NBT_Reader* reader, uint8_t* data, size_t length, NBT_Error* err);
+int   NBT_Reader_Next(NBT_Reader* reader, NBT_Token* token);
+// Skips what is left of the compound or list entered last, up to and
+// including its TAG_End. Arrays and lists of numbers are stepped over by
+// their length; compounds have none, so their tag headers are walked.
+int   NBT_Reader_Skip(NBT_Reader* reader);
+int   NBT_Token_Is(const NBT_Token* token, const char* key);
+void  NBT_Reader_Free(NBT_Reader* reader);
+void  NBT_Get_Inflate_Stats(NBT_Inflate_Stats* stats);
+// Frees the decompressor kept for the calling thread; call before a thread
+// that parsed compressed data exits
+void  NBT_Release_Thread(void);
 
 #ifdef __cplusplus
 }
@@ -24,4 +24,15 @@ typedef struct
 }
 angle_t;
 
+typedef struct
+{
+	float min_x;
+	float min_y;
+	float min_z;
+	float max_x;
+	float max_y;
+	float max_z;
+}
+aabbf_t;
+
 #endif
\ No newline at end of file
@@ -82,6 +82,11 @@ void c_packet::write_byte(uint8_t value)
     this->data.push_back(value);
 }
 
+void c_packet::write_bytes(const uint8_t* bytes, size_t size)
+{
+    this->data.insert(this->data.end(), bytes, bytes + size);
+}
+
 void c_packet::write_var_int(int32_t value) 
 {
     do 
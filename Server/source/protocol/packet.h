@@ -3,8 +3,12 @@
 
 #include <vector>
 #include <cstdint>
+#include <memory>
 #include <stdexcept>
 
+// Framed packet bytes that several connections may queue at once
+typedef std::shared_ptr<const std::vector<uint8_t>> packet_buffer_t;
+
 class c_packet
 {
 private:
@@ -12,11 +16,13 @@ private:
     int32_t read_index = 0;
 public:
     uint32_t id;
+    uint64_t received_at = 0;   // microseconds on the steady clock, inbound only
     c_packet() = default;
     explicit c_packet(const std::vector<uint8_t>& raw);
 
     uint8_t read_byte();
     void write_byte(uint8_t value);
+    void write_bytes(const uint8_t* bytes, size_t size);
     int32_t read_var_int();
     void write_var_int(int32_t value);
     int64_t read_var_long();
@@ -81,6 +81,19 @@ public:
     }
 };
 
+class c_c2s_teleport_confirm : public c_packet_c2s
+{
+public:
+    int32_t teleport_id;
+
+    c_c2s_teleport_confirm() = default;
+
+    void deserialize(c_packet& packet) override
+    {
+        this->teleport_id = packet.read_var_int();
+    }
+};
+
 class c_c2s_position : public c_packet_c2s
 {
 public:
@@ -237,11 +250,11 @@ public:
     c_s2c_chunk_data
     (
         int32_t chunk_x, int32_t chunk_y, uint8_t ground_up_continuous,
-        int32_t primary_bit_mask, std::vector<uint8_t>& data,
+        int32_t primary_bit_mask, std::vector<uint8_t> data,
         int32_t block_entity_count, std::string nbt
     )
         : chunk_x(chunk_x), chunk_y(chunk_y), ground_up_continuous(ground_up_continuous),
-        primary_bit_mask(primary_bit_mask), data(data),
+        primary_bit_mask(primary_bit_mask), data(std::move(data)),
         block_entity_count(block_entity_count), nbt(nbt) {}
 
     void serialize(c_packet& packet) const override {
@@ -251,10 +264,26 @@ public:
         packet.write_byte(this->ground_up_continuous);
         packet.write_var_int(this->primary_bit_mask);
         packet.write_var_int(this->data.size());
-        for (int i = 0; i < this->data.size(); ++i)
-            packet.write_byte(this->data.at(i));
+        packet.write_bytes(this->data.data(), this->data.size());
         packet.write_var_int(this->block_entity_count);
-        packet.write_nbt_string(this->nbt);
+        // Block entities are complete NBT compounds, written as they are
+        for (char c : this->nbt)
+            packet.write_byte(static_cast<uint8_t>(c));
+        packet.finalize();
+    }
+};
+
+class c_s2c_unload_chunk : public c_packet_s2c {
+public:
+    int32_t chunk_x, chunk_z;
+
+    c_s2c_unload_chunk(int32_t chunk_x, int32_t chunk_z)
+        : chunk_x(chunk_x), chunk_z(chunk_z) {}
+
+    void serialize(c_packet& packet) const override {
+        packet.write_var_int(0x1D);
+        packet.write_int(this->chunk_x);
+        packet.write_int(this->chunk_z);
         packet.finalize();
     }
 };
@@ -0,0 +1,138 @@
+#include "chunk_queue.h"
+
+#include <cmath>
+#include <algorithm>
+
+// Turning further than this re-sorts the queue
+#define CHUNK_QUEUE_TURN_DEGREES 30.f
+
+// Chunks closer than this are sent regardless of where the player looks
+#define CHUNK_QUEUE_NEAR 2.f
+
+// How much a chunk right behind the player is pushed back by its angle
+#define CHUNK_QUEUE_BEHIND_WEIGHT 1.5f
+
+#define DEG_TO_RAD(x) ((x) * 0.017453292f)
+
+static bool score_greater(const queued_chunk_t& a, const queued_chunk_t& b)
+{
+    return a.score > b.score;
+}
+
+c_chunk_queue::c_chunk_queue()
+    : origin{}, yaw(0.f), origin_chunk{ 0, 0 }, dirty(false)
+{
+}
+
+float c_chunk_queue::score(chunk_pos_t pos) const
+{
+    float dx = (pos.x * 16 + 8) - static_cast<float>(this->origin.x);
+    float dz = (pos.z * 16 + 8) - static_cast<float>(this->origin.z);
+    float distance = std::sqrt(dx * dx + dz * dz) / 16.f;
+
+    if (distance < CHUNK_QUEUE_NEAR)
+        return distance;
+
+    // Yaw 0 looks towards +z, 90 towards -x
+    float look_x = -std::sin(DEG_TO_RAD(this->yaw));
+    float look_z = std::cos(DEG_TO_RAD(this->yaw));
+    float cosine = (dx * look_x + dz * look_z) / (distance * 16.f);
+    float behind = (1.f - cosine) * 0.5f;
+
+    return distance * (1.f + CHUNK_QUEUE_BEHIND_WEIGHT * behind);
+}
+
+void c_chunk_queue::rebuild()
+{
+    this->heap.clear();
+    this->heap.reserve(this->queued.size());
+    for (uint64_t key : this->queued)
+    {
+        chunk_pos_t pos = chunk_from_key(key);
+        this->heap.push_back({ pos, this->score(pos) });
+    }
+    std::make_heap(this->heap.begin(), this->heap.end(), score_greater);
+    this->dirty = false;
+}
+
+void c_chunk_queue::apply(const std::vector<view_change_t>& changes, std::vector<chunk_pos_t>& unloads)
+{
+    for (const view_change_t& change : changes)
+    {
+        uint64_t key = chunk_key(change.pos);
+        if (change.load)
+        {
+            if (this->sent.count(key) || !this->queued.insert(key).second)
+                continue;
+
+            this->heap.push_back({ change.pos, this->score(change.pos) });
+            std::push_heap(this->heap.begin(), this->heap.end(), score_greater);
+        }
+        else
+        {
+            // Queued entries are dropped lazily when they reach the top
+            this->queued.erase(key);
+            if (this->sent.erase(key))
+                unloads.push_back(change.pos);
+        }
+    }
+}
+
+void c_chunk_queue::reprioritize(const vec3d_t& position, const angle_t& rotation)
+{
+    chunk_pos_t chunk = chunk_from_block(position.x, position.z);
+    float turned = std::fabs(std::remainder(rotation.yaw - this->yaw, 360.f));
+
+    if (chunk.x != this->origin_chunk.x || chunk.z != this->origin_chunk.z || turned > CHUNK_QUEUE_TURN_DEGREES)
+    {
+        this->origin = position;
+        this->origin_chunk = chunk;
+        this->yaw = rotation.yaw;
+        this->dirty = true;
+    }
+
+    // Stale entries from lazy removal also warrant a rebuild
+    if (this->heap.size() > this->queued.size() * 2 + 64)
+        this->dirty = true;
+
+    if (this->dirty)
+        this->rebuild();
+}
+
+bool c_chunk_queue::pop(chunk_pos_t& out)
+{
+    while (!this->heap.empty())
+    {
+        std::pop_heap(this->heap.begin(), this->heap.end(), score_greater);
+        queued_chunk_t top = this->heap.back();
+        this->heap.pop_back();
+
+        if (this->queued.erase(chunk_key(top.pos)))
+        {
+            out = top.pos;
+            return true;
+        }
+    }
+    return false;
+}
+
+void c_chunk_queue::requeue(chunk_pos_t pos)
+{
+    if (this->sent.count(chunk_key(pos)) || !this->queued.insert(chunk_key(pos)).second)
+        return;
+
+    this->heap.push_back({ pos, this->score(pos) });
+    std::push_heap(this->heap.begin(), this->heap.end(), score_greater);
+}
+
+void c_chunk_queue::mark_sent(chunk_pos_t pos)
+{
+    this->sent.insert(chunk_key(pos));
+}
+
+void c_chunk_queue::clear()
+{
+    this->heap.clear();
+    this->queued.clear();
+    this->sent.clear();
+}
@@ -0,0 +1,66 @@
+#ifndef IMPL_CHUNK_QUEUE_H
+#define IMPL_CHUNK_QUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <unordered_set>
+
+#include "view.h"
+#include "../math/math.h"
+#include "../world/world.h"
+
+// Chunks and bytes that may still be sent in the current tick
+typedef struct
+{
+	uint32_t chunks;
+	size_t bytes;
+}
+chunk_budget_t;
+
+typedef struct
+{
+	chunk_pos_t pos;
+	float score;
+}
+queued_chunk_t;
+
+// Per player queue of chunks waiting to be sent. The closest chunks, and
+// among them the ones the player is looking at, come out first. Scores are
+// recomputed when the player changes chunk or turns far enough.
+class c_chunk_queue
+{
+private:
+	std::vector<queued_chunk_t> heap;
+	std::unordered_set<uint64_t> queued;
+	std::unordered_set<uint64_t> sent;
+
+	vec3d_t origin;
+	float yaw;
+	chunk_pos_t origin_chunk;
+	bool dirty;
+
+	float score(chunk_pos_t pos) const;
+	void rebuild();
+public:
+	c_chunk_queue();
+
+	// Feeds view changes in; chunks that have to be removed from the client
+	// because they were already sent are appended to unloads
+	void apply(const std::vector<view_change_t>& changes, std::vector<chunk_pos_t>& unloads);
+	void reprioritize(const vec3d_t& position, const angle_t& rotation);
+
+	bool pop(chunk_pos_t& out);
+	void mark_sent(chunk_pos_t pos);
+	void clear();
+
+	// Puts back a popped chunk that couldn't be sent yet
+	void requeue(chunk_pos_t pos);
+
+	size_t size() const { return this->queued.size(); }
+	size_t sent_count() const { return this->sent.size(); }
+	const std::unordered_set<uint64_t>& get_queued() const { return this->queued; }
+	const std::unordered_set<uint64_t>& get_sent() const { return this->sent; }
+};
+
+#endif
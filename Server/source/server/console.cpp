@@ -0,0 +1,66 @@
+#include "console.h"
+
+#include <stdio.h>
+#include <iostream>
+#include <sstream>
+
+void c_console::register_command(const std::string& name, const std::string& usage, console_handler_t handler)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->commands[name] = { usage, handler };
+}
+
+bool c_console::execute(const std::string& line)
+{
+    std::istringstream iss(line);
+    std::vector<std::string> args;
+    std::string word;
+    while (iss >> word)
+        args.push_back(word);
+
+    if (args.empty())
+        return true;
+
+    console_handler_t handler;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        auto it = this->commands.find(args[0]);
+        if (it == this->commands.end())
+        {
+            printf("Unknown command: %s (try help)\r\n", args[0].c_str());
+            return false;
+        }
+        handler = it->second.handler;
+    }
+
+    try
+    {
+        handler(args);
+    }
+    catch (const std::exception& e)
+    {
+        printf("Error running %s: %s\r\n", args[0].c_str(), e.what());
+    }
+    return true;
+}
+
+void c_console::print_help()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (auto& x : this->commands)
+        printf("  %s\r\n", x.second.usage.c_str());
+}
+
+void c_console::read_loop()
+{
+    std::string line;
+    while (std::getline(std::cin, line))
+        this->execute(line);
+}
+
+void c_console::start()
+{
+    // Blocks in getline for the lifetime of the process
+    this->thread = std::thread(&c_console::read_loop, this);
+    this->thread.detach();
+}
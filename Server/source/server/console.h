@@ -0,0 +1,41 @@
+#ifndef IMPL_CONSOLE_H
+#define IMPL_CONSOLE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <functional>
+
+typedef std::function<void(const std::vector<std::string>& args)> console_handler_t;
+
+typedef struct
+{
+	std::string usage;
+	console_handler_t handler;
+}
+console_command_t;
+
+// Commands typed into the server's standard input. Handlers run on the
+// console thread and have to do their own locking.
+class c_console
+{
+private:
+	std::mutex mutex;
+	std::map<std::string, console_command_t> commands;
+	std::thread thread;
+
+	void read_loop();
+public:
+	c_console() = default;
+	c_console(const c_console&) = delete;
+	c_console& operator=(const c_console&) = delete;
+
+	void register_command(const std::string& name, const std::string& usage, console_handler_t handler);
+	bool execute(const std::string& line);
+	void print_help();
+	void start();
+};
+
+#endif
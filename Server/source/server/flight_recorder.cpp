@@ -0,0 +1,213 @@
+#include "flight_recorder.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+static const char* phase_names[flight_phase_count] = { "tasks", "loads", "part", "regions", "merge", "jobs" };
+
+c_flight_recorder::c_flight_recorder()
+    : head(0), count(0), threshold_ms(0.f), dumped(false), dump_requested(false), writing(false), slow{}
+{
+    this->configure(600, 0.f, "spikes");
+}
+
+c_flight_recorder::~c_flight_recorder()
+{
+    if (this->writer.joinable())
+        this->writer.join();
+}
+
+void c_flight_recorder::configure(size_t ticks, float threshold_ms, const std::string& directory)
+{
+    this->ring.assign(ticks < 1 ? 1 : ticks, flight_tick_t{});
+    this->head = 0;
+    this->count = 0;
+    this->threshold_ms = threshold_ms;
+    this->directory = directory;
+}
+
+void c_flight_recorder::note_slow(const char* name, float ms)
+{
+    if (ms < FLIGHT_SLOW_MS)
+        return;
+
+    std::lock_guard<std::mutex> lock(this->slow_mutex);
+
+    // Kept sorted, slowest first
+    int slot = FLIGHT_SLOW_HANDLERS;
+    while (slot > 0 && (!this->slow[slot - 1].name[0] || this->slow[slot - 1].ms < ms))
+        slot--;
+    if (slot >= FLIGHT_SLOW_HANDLERS)
+        return;
+
+    memmove(&this->slow[slot + 1], &this->slow[slot], (FLIGHT_SLOW_HANDLERS - slot - 1) * sizeof(flight_handler_t));
+    snprintf(this->slow[slot].name, sizeof(this->slow[slot].name), "%s", name);
+    this->slow[slot].ms = ms;
+}
+
+void c_flight_recorder::record(flight_tick_t& tick)
+{
+    tick.unix_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()
+        ).count();
+
+    {
+        std::lock_guard<std::mutex> lock(this->slow_mutex);
+        memcpy(tick.slow, this->slow, sizeof(tick.slow));
+        memset(this->slow, 0, sizeof(this->slow));
+    }
+
+    this->ring[this->head] = tick;
+    this->head = (this->head + 1) % this->ring.size();
+    if (this->count < this->ring.size())
+        this->count++;
+
+    if (this->dump_requested.exchange(false))
+    {
+        this->dump("requested from the console");
+        return;
+    }
+
+    if (this->threshold_ms <= 0.f || tick.total_ms < this->threshold_ms)
+        return;
+
+    tick_clock_t::time_point now = tick_clock_t::now();
+    if (this->dumped && now - this->last_dump < std::chrono::seconds(FLIGHT_DUMP_COOLDOWN))
+        return;
+
+    this->dumped = true;
+    this->last_dump = now;
+
+    char reason[96];
+    snprintf(reason, sizeof(reason), "tick %llu took %.1f ms (threshold %.1f ms)",
+        (unsigned long long)tick.tick, tick.total_ms, this->threshold_ms);
+    this->dump(reason);
+}
+
+void c_flight_recorder::copy_ring(std::vector<flight_tick_t>& out) const
+{
+    size_t capacity = this->ring.size();
+    size_t begin = (this->head + capacity - this->count) % capacity;
+    out.clear();
+    out.reserve(this->count);
+    for (size_t i = 0; i < this->count; i++)
+        out.push_back(this->ring[(begin + i) % capacity]);
+}
+
+static void format_time(int64_t unix_ms, const char* format, char* out, size_t size)
+{
+    time_t seconds = static_cast<time_t>(unix_ms / 1000);
+    struct tm local;
+#ifdef _WIN32
+    localtime_s(&local, &seconds);
+#else
+    localtime_r(&seconds, &local);
+#endif
+    if (strftime(out, size, format, &local) == 0)
+        out[0] = '\0';
+}
+
+static void write_ring(const std::string& path, const std::string& reason, const std::vector<flight_tick_t>& ticks)
+{
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file)
+    {
+        printf("Flight recorder couldn't write %s\r\n", path.c_str());
+        return;
+    }
+
+    fprintf(file, "# Flight recorder: %s\n", reason.c_str());
+    fprintf(file, "# %zu ticks, oldest first\n", ticks.size());
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 heap = mallinfo2();
+    fprintf(file, "# heap: arena %zu, mmap %zu, in use %zu, free %zu\n",
+        heap.arena, heap.hblkhd, heap.uordblks, heap.fordblks);
+#endif
+
+    fprintf(file, "%-10s %-12s %8s", "tick", "time", "total");
+    for (int i = 0; i < flight_phase_count; i++)
+        fprintf(file, " %7s", phase_names[i]);
+    fprintf(file, " %7s %7s %7s %7s %9s %9s %9s %6s %4s  %s\n",
+        "players", "regions", "pk_in", "pk_out", "kb_in", "kb_out", "queue_kb", "chunks", "jobs", "slow (ms)");
+
+    for (const flight_tick_t& tick : ticks)
+    {
+        char time[16];
+        format_time(tick.unix_ms, "%H:%M:%S", time, sizeof(time));
+        size_t length = strlen(time);
+        snprintf(time + length, sizeof(time) - length, ".%03d", static_cast<int>(tick.unix_ms % 1000));
+
+        fprintf(file, "%-10llu %-12s %8.2f", (unsigned long long)tick.tick, time, tick.total_ms);
+        for (int i = 0; i < flight_phase_count; i++)
+            fprintf(file, " %7.2f", tick.phase_ms[i]);
+        fprintf(file, " %7u %7u %7llu %7llu %9.1f %9.1f %9.1f %6u %4u ",
+            tick.players, tick.regions, (unsigned long long)tick.packets_in, (unsigned long long)tick.packets_out,
+            tick.bytes_in / 1024.0, tick.bytes_out / 1024.0, tick.send_queue_bytes / 1024.0, tick.chunks_queued, tick.jobs_queued);
+
+        for (int i = 0; i < FLIGHT_SLOW_HANDLERS && tick.slow[i].name[0]; i++)
+            fprintf(file, " %s=%.2f", tick.slow[i].name, tick.slow[i].ms);
+        fprintf(file, "\n");
+    }
+
+    fclose(file);
+    printf("Flight recorder: %s, wrote %s\r\n", reason.c_str(), path.c_str());
+}
+
+std::string c_flight_recorder::dump(const std::string& reason)
+{
+    if (!this->count)
+        return std::string();
+
+    // The tick thread doesn't wait for the disk, a spike during a write
+    // is dropped instead
+    if (this->writing)
+    {
+        printf("Flight recorder: %s, still writing the last dump\r\n", reason.c_str());
+        return std::string();
+    }
+    if (this->writer.joinable())
+        this->writer.join();
+
+    std::shared_ptr<std::vector<flight_tick_t>> ticks = std::make_shared<std::vector<flight_tick_t>>();
+    this->copy_ring(*ticks);
+
+    const flight_tick_t& last = ticks->back();
+    char name[64];
+    format_time(last.unix_ms, "%Y%m%d-%H%M%S", name, sizeof(name));
+
+    std::string path = this->directory;
+    if (!path.empty())
+    {
+#ifdef _WIN32
+        _mkdir(path.c_str());
+#else
+        mkdir(path.c_str(), 0755);
+#endif
+        path += "/";
+    }
+    path += "spike-" + std::string(name) + "-" + std::to_string(last.tick) + ".log";
+
+    // Disk writes stay off the tick thread
+    this->writing = true;
+    this->writer = std::thread([this, path, reason, ticks]()
+    {
+        write_ring(path, reason, *ticks);
+        this->writing = false;
+    });
+    return path;
+}
@@ -0,0 +1,103 @@
+#ifndef IMPL_FLIGHT_RECORDER_H
+#define IMPL_FLIGHT_RECORDER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tick.h"
+
+// Anything slower than this is worth naming in the record
+#define FLIGHT_SLOW_MS			1.f
+#define FLIGHT_SLOW_HANDLERS	4
+
+// Seconds between two automatic dumps, so a server that keeps lagging
+// doesn't fill the disk
+#define FLIGHT_DUMP_COOLDOWN	30
+
+typedef enum
+{
+	flight_tasks = 0,
+	flight_chunk_loads,
+	flight_partition,
+	flight_regions,
+	flight_merge,
+	flight_jobs,
+	flight_phase_count
+}
+flight_phase_t;
+
+typedef struct
+{
+	char name[28];
+	float ms;
+}
+flight_handler_t;
+
+typedef struct
+{
+	uint64_t tick;
+	int64_t unix_ms;
+	float total_ms;
+	float phase_ms[flight_phase_count];
+	uint32_t players;
+	uint32_t regions;
+	uint64_t packets_in;		// during this tick
+	uint64_t packets_out;
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	uint64_t send_queue_bytes;
+	uint32_t chunks_queued;
+	uint32_t jobs_queued;
+	flight_handler_t slow[FLIGHT_SLOW_HANDLERS];	// slowest first, empty names unused
+}
+flight_tick_t;
+
+// Always-on ring of the last few hundred ticks. A tick slower than the
+// threshold writes the whole ring to a timestamped file, so the ticks that
+// led up to a lag spike can be looked at after the fact. Files are written
+// from a copy of the ring by one writer thread at a time, which is joined
+// before the recorder goes away.
+class c_flight_recorder
+{
+private:
+	std::vector<flight_tick_t> ring;
+	size_t head;
+	size_t count;
+	float threshold_ms;
+	std::string directory;
+	tick_clock_t::time_point last_dump;
+	bool dumped;
+	std::atomic<bool> dump_requested;
+
+	std::thread writer;
+	std::atomic<bool> writing;
+
+	std::mutex slow_mutex;
+	flight_handler_t slow[FLIGHT_SLOW_HANDLERS];
+
+	void copy_ring(std::vector<flight_tick_t>& out) const;
+	std::string dump(const std::string& reason);
+public:
+	c_flight_recorder();
+	~c_flight_recorder();
+
+	void configure(size_t ticks, float threshold_ms, const std::string& directory);
+
+	// Any thread; cheap enough to call for everything slower than FLIGHT_SLOW_MS
+	void note_slow(const char* name, float ms);
+
+	// Tick thread, once per tick
+	void record(flight_tick_t& tick);
+
+	// Any thread; the ring is written after the next tick
+	void request_dump() { this->dump_requested = true; }
+
+	float get_threshold() const { return this->threshold_ms; }
+};
+
+#endif
@@ -0,0 +1,518 @@
+#include "metrics.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/select.h>
+#endif
+
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+// Requests larger than this are not a scrape
+#define METRICS_MAX_REQUEST 8192
+
+static const double mspt_bounds[METRICS_MSPT_BUCKETS] = { 1, 2, 5, 10, 20, 30, 40, 50, 100, 250 };
+
+static const char* state_names[METRICS_STATES] = { "handshake", "status", "login", "play" };
+static const char* direction_names[metrics_directions] = { "in", "out" };
+
+static thread_local void* current_shard = nullptr;
+
+// Single writer per shard, so a load and a store is enough and avoids the
+// locked instruction a fetch_add would be
+static inline void bump(std::atomic<uint64_t>& counter, uint64_t value)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+c_metrics& c_metrics::instance()
+{
+    static c_metrics metrics;
+    return metrics;
+}
+
+c_metrics::metrics_shard_t* c_metrics::get_shard()
+{
+    if (current_shard)
+        return static_cast<metrics_shard_t*>(current_shard);
+
+    std::unique_ptr<metrics_shard_t> shard = std::make_unique<metrics_shard_t>();
+    memset(static_cast<void*>(shard.get()), 0, sizeof(metrics_shard_t));
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    current_shard = shard.get();
+    this->shards.push_back(std::move(shard));
+    return static_cast<metrics_shard_t*>(current_shard);
+}
+
+void c_metrics::count_packet(metrics_direction_t direction, int state, uint32_t id, size_t bytes)
+{
+    if (state < 0 || state >= METRICS_STATES || id >= METRICS_PACKET_IDS)
+        return;
+
+    metrics_shard_t* shard = this->get_shard();
+    bump(shard->packets[direction][state][id], 1);
+    bump(shard->bytes[direction][state][id], bytes);
+    bump(shard->total_packets[direction], 1);
+    bump(shard->total_bytes[direction], bytes);
+}
+
+void c_metrics::get_totals(uint64_t packets[metrics_directions], uint64_t bytes[metrics_directions])
+{
+    for (int d = 0; d < metrics_directions; d++)
+        packets[d] = bytes[d] = 0;
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (std::unique_ptr<metrics_shard_t>& shard : this->shards)
+    {
+        for (int d = 0; d < metrics_directions; d++)
+        {
+            packets[d] += shard->total_packets[d].load(std::memory_order_relaxed);
+            bytes[d] += shard->total_bytes[d].load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void c_metrics::observe_mspt(double ms)
+{
+    metrics_shard_t* shard = this->get_shard();
+    for (int i = 0; i < METRICS_MSPT_BUCKETS; i++)
+    {
+        if (ms <= mspt_bounds[i])
+        {
+            bump(shard->mspt_buckets[i], 1);
+            break;
+        }
+    }
+    bump(shard->mspt_count, 1);
+    bump(shard->mspt_sum_us, static_cast<uint64_t>(ms * 1000.0));
+}
+
+void c_metrics::observe_latency(metrics_direction_t direction, outbound_class_t cls, uint64_t micros)
+{
+    metrics_shard_t* shard = this->get_shard();
+    bump(shard->latency[direction][cls][c_histogram::bucket_of(micros)], 1);
+}
+
+void c_metrics::get_latency(metrics_direction_t direction, outbound_class_t cls, c_histogram& out)
+{
+    out.reset();
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (std::unique_ptr<metrics_shard_t>& shard : this->shards)
+    {
+        for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+            out.add(i, shard->latency[direction][cls][i].load(std::memory_order_relaxed));
+    }
+}
+
+const char* metrics_state_name(int state)
+{
+    return state_names[state];
+}
+
+void metrics_header(std::string& out, const char* name, const char* type, const char* help)
+{
+    out += "# HELP ";
+    out += name;
+    out += " ";
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += " ";
+    out += type;
+    out += "\n";
+}
+
+void metrics_value(std::string& out, const char* name, const char* labels, double value)
+{
+    char line[256];
+    if (labels && *labels)
+        snprintf(line, sizeof(line), "%s{%s} %.15g\n", name, labels, value);
+    else
+        snprintf(line, sizeof(line), "%s %.15g\n", name, value);
+    out += line;
+}
+
+void c_metrics::render(std::string& out)
+{
+    typedef struct
+    {
+        uint64_t packets[metrics_directions][METRICS_STATES][METRICS_PACKET_IDS];
+        uint64_t bytes[metrics_directions][METRICS_STATES][METRICS_PACKET_IDS];
+    }
+    packet_totals_t;
+
+    std::unique_ptr<packet_totals_t> totals = std::make_unique<packet_totals_t>();
+    uint64_t buckets[METRICS_MSPT_BUCKETS] = {};
+    uint64_t mspt_count = 0, mspt_sum_us = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        for (std::unique_ptr<metrics_shard_t>& shard : this->shards)
+        {
+            for (int d = 0; d < metrics_directions; d++)
+            {
+                for (int s = 0; s < METRICS_STATES; s++)
+                {
+                    for (int id = 0; id < METRICS_PACKET_IDS; id++)
+                    {
+                        totals->packets[d][s][id] += shard->packets[d][s][id].load(std::memory_order_relaxed);
+                        totals->bytes[d][s][id] += shard->bytes[d][s][id].load(std::memory_order_relaxed);
+                    }
+                }
+            }
+
+            for (int i = 0; i < METRICS_MSPT_BUCKETS; i++)
+                buckets[i] += shard->mspt_buckets[i].load(std::memory_order_relaxed);
+            mspt_count += shard->mspt_count.load(std::memory_order_relaxed);
+            mspt_sum_us += shard->mspt_sum_us.load(std::memory_order_relaxed);
+        }
+    }
+
+    char labels[128];
+
+    metrics_header(out, "mc_packets_total", "counter", "Packets by direction, connection state and packet id");
+    for (int d = 0; d < metrics_directions; d++)
+    {
+        for (int s = 0; s < METRICS_STATES; s++)
+        {
+            for (int id = 0; id < METRICS_PACKET_IDS; id++)
+            {
+                if (!totals->packets[d][s][id])
+                    continue;
+                snprintf(labels, sizeof(labels), "direction=\"%s\",state=\"%s\",id=\"0x%02X\"", direction_names[d], state_names[s], id);
+                metrics_value(out, "mc_packets_total", labels, static_cast<double>(totals->packets[d][s][id]));
+            }
+        }
+    }
+
+    metrics_header(out, "mc_packet_bytes_total", "counter", "Packet bytes by direction, connection state and packet id");
+    for (int d = 0; d < metrics_directions; d++)
+    {
+        for (int s = 0; s < METRICS_STATES; s++)
+        {
+            for (int id = 0; id < METRICS_PACKET_IDS; id++)
+            {
+                if (!totals->packets[d][s][id])
+                    continue;
+                snprintf(labels, sizeof(labels), "direction=\"%s\",state=\"%s\",id=\"0x%02X\"", direction_names[d], state_names[s], id);
+                metrics_value(out, "mc_packet_bytes_total", labels, static_cast<double>(totals->bytes[d][s][id]));
+            }
+        }
+    }
+
+    metrics_header(out, "mc_tick_duration_milliseconds", "histogram", "Time spent in each tick");
+    uint64_t cumulative = 0;
+    for (int i = 0; i < METRICS_MSPT_BUCKETS; i++)
+    {
+        cumulative += buckets[i];
+        snprintf(labels, sizeof(labels), "le=\"%g\"", mspt_bounds[i]);
+        metrics_value(out, "mc_tick_duration_milliseconds_bucket", labels, static_cast<double>(cumulative));
+    }
+    metrics_value(out, "mc_tick_duration_milliseconds_bucket", "le=\"+Inf\"", static_cast<double>(mspt_count));
+    metrics_value(out, "mc_tick_duration_milliseconds_sum", nullptr, mspt_sum_us / 1000.0);
+    metrics_value(out, "mc_tick_duration_milliseconds_count", nullptr, static_cast<double>(mspt_count));
+
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    c_histogram latency;
+
+    metrics_header(out, "mc_packet_latency_microseconds", "summary", "Inbound recv to dispatch and outbound queue to kernel, by packet class");
+    for (int d = 0; d < metrics_directions; d++)
+    {
+        for (int cls = 0; cls < outbound_class_count; cls++)
+        {
+            this->get_latency(static_cast<metrics_direction_t>(d), static_cast<outbound_class_t>(cls), latency);
+            if (!latency.get_count())
+                continue;
+
+            for (double quantile : quantiles)
+            {
+                snprintf(labels, sizeof(labels), "direction=\"%s\",class=\"%s\",quantile=\"%g\"",
+                    direction_names[d], outbound_class_name(static_cast<outbound_class_t>(cls)), quantile);
+                metrics_value(out, "mc_packet_latency_microseconds", labels, static_cast<double>(latency.percentile(quantile)));
+            }
+
+            snprintf(labels, sizeof(labels), "direction=\"%s\",class=\"%s\"", direction_names[d], outbound_class_name(static_cast<outbound_class_t>(cls)));
+            metrics_value(out, "mc_packet_latency_microseconds_sum", labels, latency.get_mean() * latency.get_count());
+            metrics_value(out, "mc_packet_latency_microseconds_count", labels, static_cast<double>(latency.get_count()));
+        }
+    }
+}
+
+c_metrics_endpoint::c_metrics_endpoint()
+    : listener(SOCK_ERR)
+{
+}
+
+c_metrics_endpoint::~c_metrics_endpoint()
+{
+    this->stop();
+}
+
+static void set_non_blocking(socket_t fd)
+{
+#ifdef _WIN32
+    u_long mode = 1;
+    ioctlsocket(fd, FIONBIO, &mode);
+#else
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+#endif
+}
+
+static bool would_block()
+{
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EWOULDBLOCK || errno == EAGAIN;
+#endif
+}
+
+bool c_metrics_endpoint::open(uint16_t port)
+{
+    this->listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (this->listener == SOCK_ERR)
+        return false;
+
+    int reuse = 1;
+    setsockopt(this->listener, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+
+    if (bind(this->listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == SOCK_ERR_VAL ||
+        listen(this->listener, 8) == SOCK_ERR_VAL)
+    {
+        CLOSE_SOCKET(this->listener);
+        this->listener = SOCK_ERR;
+        return false;
+    }
+
+    set_non_blocking(this->listener);
+    return true;
+}
+
+void c_metrics_endpoint::stop()
+{
+    if (this->background_thread.joinable())
+        this->background_thread.join();
+
+    for (auto& x : this->clients)
+        CLOSE_SOCKET(x.first);
+    this->clients.clear();
+
+    if (this->listener != SOCK_ERR)
+    {
+        CLOSE_SOCKET(this->listener);
+        this->listener = SOCK_ERR;
+    }
+}
+
+bool c_metrics_endpoint::prepare(fd_set& read_fds, fd_set& write_fds, int& max_fd)
+{
+    if (this->listener == SOCK_ERR)
+        return false;
+
+    FD_SET(this->listener, &read_fds);
+    if (static_cast<int>(this->listener) > max_fd)
+        max_fd = static_cast<int>(this->listener);
+
+    bool waiting = false;
+    for (auto& x : this->clients)
+    {
+        // Nothing more is read while the request is being answered in
+        // the background
+        if (x.second.background)
+        {
+            waiting = true;
+            continue;
+        }
+
+        if (x.second.response.empty())
+            FD_SET(x.first, &read_fds);
+        else
+            FD_SET(x.first, &write_fds);
+
+        if (static_cast<int>(x.first) > max_fd)
+            max_fd = static_cast<int>(x.first);
+    }
+    return waiting;
+}
+
+void c_metrics_endpoint::route(const std::string& path, const http_handler_t& handler, bool background)
+{
+    this->routes[path] = { handler, background };
+}
+
+static const char* status_text(int status)
+{
+    switch (status)
+    {
+    case 200: return "200 OK";
+    case 400: return "400 Bad Request";
+    case 404: return "404 Not Found";
+    case 405: return "405 Method Not Allowed";
+    case 409: return "409 Conflict";
+    default: return "500 Internal Server Error";
+    }
+}
+
+void c_metrics_endpoint::respond(http_client_t& client)
+{
+    int code = 200;
+    std::string body;
+
+    // "GET /path?query HTTP/1.1"
+    size_t target = client.request.find(' ');
+    size_t version = target == std::string::npos ? std::string::npos : client.request.find(' ', target + 1);
+    if (version == std::string::npos || client.request.compare(0, target, "GET") != 0)
+    {
+        code = 405;
+    }
+    else
+    {
+        std::string path = client.request.substr(target + 1, version - target - 1);
+        std::string query;
+        size_t mark = path.find('?');
+        if (mark != std::string::npos)
+        {
+            query = path.substr(mark + 1);
+            path.erase(mark);
+        }
+
+        auto route = this->routes.find(path);
+        if (route == this->routes.end())
+        {
+            code = 404;
+        }
+        else if (route->second.background && this->background_thread.joinable())
+        {
+            code = 409;
+            body = "another request is still being answered\n";
+        }
+        else if (route->second.background)
+        {
+            std::shared_ptr<http_background_t> background = std::make_shared<http_background_t>();
+            background->done = false;
+            client.background = background;
+
+            http_handler_t handler = route->second.handler;
+            this->background_thread = std::thread([handler, query, background]
+            {
+                background->code = handler(query, background->body);
+                background->done.store(true, std::memory_order_release);
+            });
+            return;
+        }
+        else
+        {
+            code = route->second.handler(query, body);
+        }
+    }
+
+    this->finish(client, code, body);
+}
+
+void c_metrics_endpoint::finish(http_client_t& client, int code, const std::string& body)
+{
+    const char* status = status_text(code);
+
+    char header[256];
+    snprintf(header, sizeof(header),
+        "HTTP/1.1 %s\r\n"
+        "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+        "Content-Length: %zu\r\n"
+        "Connection: close\r\n\r\n",
+        status, body.size());
+
+    client.response = header;
+    client.response += body;
+    client.sent = 0;
+}
+
+void c_metrics_endpoint::process(fd_set& read_fds, fd_set& write_fds)
+{
+    if (this->listener == SOCK_ERR)
+        return;
+
+    if (FD_ISSET(this->listener, &read_fds))
+    {
+        FD_CLR(this->listener, &read_fds);
+
+        socket_t fd = accept(this->listener, nullptr, nullptr);
+        if (fd != SOCK_ERR)
+        {
+            set_non_blocking(fd);
+            http_client_t client{};
+            this->clients[fd] = std::move(client);
+        }
+    }
+
+    for (auto it = this->clients.begin(); it != this->clients.end();)
+    {
+        socket_t fd = it->first;
+        http_client_t& client = it->second;
+        bool closed = false;
+
+        if (client.background && client.background->done.load(std::memory_order_acquire))
+        {
+            // Only returning from the handler is left to the thread
+            this->background_thread.join();
+            this->finish(client, client.background->code, client.background->body);
+            client.background.reset();
+        }
+
+        if (FD_ISSET(fd, &read_fds))
+        {
+            FD_CLR(fd, &read_fds);
+
+            char buffer[1024];
+            int received = recv(fd, buffer, sizeof(buffer), 0);
+            if (received <= 0)
+            {
+                closed = true;
+            }
+            else
+            {
+                client.request.append(buffer, received);
+                if (client.request.find("\r\n\r\n") != std::string::npos)
+                    this->respond(client);
+                else if (client.request.size() > METRICS_MAX_REQUEST)
+                    closed = true;
+            }
+        }
+
+        if (!closed && FD_ISSET(fd, &write_fds))
+        {
+            FD_CLR(fd, &write_fds);
+
+            int sent = send(fd, client.response.data() + client.sent,
+                static_cast<int>(client.response.size() - client.sent), SEND_FLAGS);
+            if (sent == SOCK_ERR_VAL)
+                closed = !would_block();
+            else if ((client.sent += sent) == client.response.size())
+                closed = true;
+        }
+
+        if (closed)
+        {
+            CLOSE_SOCKET(fd);
+            it = this->clients.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
@@ -0,0 +1,144 @@
+#ifndef IMPL_METRICS_H
+#define IMPL_METRICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "network.h"
+#include "outbound.h"
+#include "../util/histogram.h"
+
+#define METRICS_STATES			4		// connection_state_t
+#define METRICS_PACKET_IDS		256
+#define METRICS_MSPT_BUCKETS	10
+
+typedef enum
+{
+	metrics_in = 0,
+	metrics_out,
+	metrics_directions
+}
+metrics_direction_t;
+
+// Counters for hot paths. Every thread increments its own shard with
+// plain relaxed stores, so counting never contends; a scrape adds the
+// shards up.
+class c_metrics
+{
+private:
+	typedef struct
+	{
+		std::atomic<uint64_t> packets[metrics_directions][METRICS_STATES][METRICS_PACKET_IDS];
+		std::atomic<uint64_t> bytes[metrics_directions][METRICS_STATES][METRICS_PACKET_IDS];
+		std::atomic<uint64_t> total_packets[metrics_directions];
+		std::atomic<uint64_t> total_bytes[metrics_directions];
+		std::atomic<uint64_t> mspt_buckets[METRICS_MSPT_BUCKETS];
+		std::atomic<uint64_t> mspt_count;
+		std::atomic<uint64_t> mspt_sum_us;
+		std::atomic<uint64_t> latency[metrics_directions][outbound_class_count][HISTOGRAM_BUCKETS];
+	}
+	metrics_shard_t;
+
+	std::mutex mutex;		// only guards the list of shards
+	std::vector<std::unique_ptr<metrics_shard_t>> shards;
+
+	c_metrics() = default;
+	metrics_shard_t* get_shard();
+public:
+	static c_metrics& instance();
+
+	void count_packet(metrics_direction_t direction, int state, uint32_t id, size_t bytes);
+	void observe_mspt(double ms);
+
+	// Packets and bytes over all ids, cheap enough to read every tick
+	void get_totals(uint64_t packets[metrics_directions], uint64_t bytes[metrics_directions]);
+
+	// Time between recv and dispatch for inbound packets, and between
+	// send_packet and the kernel taking the last byte for outbound ones
+	void observe_latency(metrics_direction_t direction, outbound_class_t cls, uint64_t micros);
+	void get_latency(metrics_direction_t direction, outbound_class_t cls, c_histogram& out);
+
+	// Appends the counters in Prometheus text format
+	void render(std::string& out);
+};
+
+// Prometheus text format helpers
+// Label value of a connection_state_t below METRICS_STATES
+const char* metrics_state_name(int state);
+
+void metrics_header(std::string& out, const char* name, const char* type, const char* help);
+void metrics_value(std::string& out, const char* name, const char* labels, double value);
+
+// Fills the body for a GET of the route's path and returns the HTTP status.
+// The query is whatever followed '?', empty without one.
+typedef std::function<int(const std::string& query, std::string& body)> http_handler_t;
+
+// Minimal HTTP/1.1 endpoint answering GET requests for the paths routed to
+// it, /metrics and the debug handles. It has no thread of its own: the
+// server's select loop adds its sockets to the sets and hands the results
+// back, so a request is served between two batches of packets, on the
+// network thread. Routes too slow for that run on a thread of their own.
+class c_metrics_endpoint
+{
+private:
+	typedef struct
+	{
+		http_handler_t handler;
+		bool background;
+	}
+	http_route_t;
+
+	// Answer of a background handler, filled in by its thread
+	typedef struct
+	{
+		std::atomic<bool> done;
+		int code;
+		std::string body;
+	}
+	http_background_t;
+
+	typedef struct
+	{
+		std::string request;
+		std::string response;
+		size_t sent;
+		std::shared_ptr<http_background_t> background;
+	}
+	http_client_t;
+
+	socket_t listener;
+	std::map<socket_t, http_client_t> clients;
+	std::map<std::string, http_route_t> routes;
+	std::thread background_thread;	// at most one background handler at a time
+
+	void respond(http_client_t& client);
+	void finish(http_client_t& client, int code, const std::string& body);
+public:
+	c_metrics_endpoint();
+	~c_metrics_endpoint();
+
+	// A background handler runs on a thread of its own, so it must only touch
+	// state that is safe to share. Only one runs at a time, others are
+	// answered with 409 meanwhile; stop() waits for it.
+	void route(const std::string& path, const http_handler_t& handler, bool background = false);
+
+	bool open(uint16_t port);
+	void stop();
+
+	// True while a background handler is running; select should then time
+	// out now and then so process() can pick its answer up
+	bool prepare(fd_set& read_fds, fd_set& write_fds, int& max_fd);
+
+	// Handles and clears the endpoint's sockets from both sets
+	void process(fd_set& read_fds, fd_set& write_fds);
+};
+
+#endif
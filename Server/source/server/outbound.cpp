@@ -0,0 +1,174 @@
+#include "outbound.h"
+#include "metrics.h"
+
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#endif
+
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+const char* outbound_class_name(outbound_class_t cls)
+{
+    static const char* names[outbound_class_count] = { "control", "movement", "chat", "bulk" };
+    return cls >= 0 && cls < outbound_class_count ? names[cls] : "unknown";
+}
+
+c_outbound_queue::c_outbound_queue()
+    : queued_bytes{}, total_bytes(0), current{}, current_class(outbound_control), current_offset(0), config{}, tokens(0.0),
+    last_refill(std::chrono::steady_clock::now())
+{
+}
+
+void c_outbound_queue::configure(const outbound_config_t& config)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->config = config;
+    this->tokens = config.burst;
+    this->last_refill = std::chrono::steady_clock::now();
+}
+
+void c_outbound_queue::refill()
+{
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - this->last_refill).count();
+    this->last_refill = now;
+
+    this->tokens += elapsed * this->config.rate;
+    if (this->tokens > this->config.burst)
+        this->tokens = this->config.burst;
+}
+
+size_t c_outbound_queue::kernel_queued(socket_t fd) const
+{
+#ifdef __linux__
+    int queued = 0;
+    if (ioctl(fd, SIOCOUTQ, &queued) == 0 && queued > 0)
+        return static_cast<size_t>(queued);
+#else
+    (void)fd;
+#endif
+    return 0;
+}
+
+int c_outbound_queue::next_class(size_t kernel) const
+{
+    for (int cls = 0; cls < outbound_class_count; cls++)
+    {
+        if (this->queues[cls].empty())
+            continue;
+
+        // Control traffic is tiny and must never wait behind anything
+        if (cls == outbound_control)
+            return cls;
+
+        if (this->config.rate && this->tokens <= 0.0)
+            return -1;
+
+        // Keep the kernel queue short so later urgent packets are not stuck
+        // behind megabytes of chunk data we already handed over
+        if (cls == outbound_bulk && this->config.watermark && kernel >= this->config.watermark)
+            return -1;
+
+        return cls;
+    }
+    return -1;
+}
+
+bool c_outbound_queue::push(packet_buffer_t data, outbound_class_t cls)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    if (cls != outbound_control && this->config.max_queued && this->total_bytes >= this->config.max_queued)
+        return false;
+
+    this->queued_bytes[cls] += data->size();
+    this->total_bytes += data->size();
+    this->queues[cls].push_back({ std::move(data), monotonic_micros() });
+    return true;
+}
+
+flush_result_t c_outbound_queue::flush(socket_t fd)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    this->refill();
+    size_t kernel = this->kernel_queued(fd);
+
+    while (true)
+    {
+        if (!this->current.data)
+        {
+            int cls = this->next_class(kernel);
+            if (cls < 0)
+                return flush_done;
+
+            this->current = std::move(this->queues[cls].front());
+            this->current_class = static_cast<outbound_class_t>(cls);
+            this->queues[cls].pop_front();
+            this->queued_bytes[cls] -= this->current.data->size();
+            this->total_bytes -= this->current.data->size();
+            this->current_offset = 0;
+        }
+
+        const std::vector<uint8_t>& out = *this->current.data;
+        int sent = send
+        (
+            fd,
+            reinterpret_cast<const char*>(out.data() + this->current_offset),
+            static_cast<int>(out.size() - this->current_offset),
+            SEND_FLAGS
+        );
+
+        if (sent == SOCK_ERR_VAL)
+        {
+#ifdef _WIN32
+            int error = WSAGetLastError();
+            if (error == WSAEWOULDBLOCK)
+                return flush_blocked;
+            printf("Send failed with error: %d\n", error);
+#else
+            if (errno == EWOULDBLOCK || errno == EAGAIN)
+                return flush_blocked;
+            printf("Send failed with error: %s (errno: %d)\n", strerror(errno), errno);
+#endif
+            return flush_error;
+        }
+        else if (sent == 0)
+        {
+            printf("Connection closed by peer\n");
+            return flush_error;
+        }
+
+        this->current_offset += sent;
+        this->tokens -= sent;
+        kernel += sent;
+
+        if (this->current_offset == out.size())
+        {
+            c_metrics::instance().observe_latency(metrics_out, this->current_class, monotonic_micros() - this->current.queued_at);
+            this->current.data.reset();
+        }
+    }
+}
+
+size_t c_outbound_queue::pending(outbound_class_t cls)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->queued_bytes[cls];
+}
+
+size_t c_outbound_queue::pending()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    size_t in_flight = this->current.data ? this->current.data->size() - this->current_offset : 0;
+    return this->total_bytes + in_flight;
+}
@@ -0,0 +1,90 @@
+#ifndef IMPL_OUTBOUND_H
+#define IMPL_OUTBOUND_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <chrono>
+
+#include "network.h"
+#include "../protocol/packet.h"
+
+// Lower values are written first
+typedef enum
+{
+	outbound_control = 0,	// keep alive, login, status, ...
+	outbound_movement,
+	outbound_chat,
+	outbound_bulk,			// chunks
+	outbound_class_count
+}
+outbound_class_t;
+
+typedef enum
+{
+	flush_done = 0,		// nothing left that may be written now
+	flush_blocked,		// the socket is full
+	flush_error
+}
+flush_result_t;
+
+typedef struct
+{
+	uint32_t rate;			// bytes per second, 0 for unlimited
+	uint32_t burst;			// token bucket size
+	uint32_t watermark;		// kernel send queue size above which bulk waits
+	uint32_t max_queued;	// queued bytes after which the client is dropped
+}
+outbound_config_t;
+
+const char* outbound_class_name(outbound_class_t cls);
+
+// Outbound packets of one connection, one FIFO per class. flush() writes
+// the highest class first, as far as the token bucket and the kernel send
+// queue allow; a packet that was partially written always completes first
+// so framing is kept.
+class c_outbound_queue
+{
+private:
+	typedef struct
+	{
+		packet_buffer_t data;
+		uint64_t queued_at;		// microseconds, for latency
+	}
+	queued_packet_t;
+
+	std::mutex mutex;
+	std::deque<queued_packet_t> queues[outbound_class_count];
+	size_t queued_bytes[outbound_class_count];
+	size_t total_bytes;
+
+	queued_packet_t current;
+	outbound_class_t current_class;
+	size_t current_offset;
+
+	outbound_config_t config;
+	double tokens;
+	std::chrono::steady_clock::time_point last_refill;
+
+	void refill();
+	size_t kernel_queued(socket_t fd) const;
+	int next_class(size_t kernel) const;
+public:
+	c_outbound_queue();
+	c_outbound_queue(const c_outbound_queue&) = delete;
+	c_outbound_queue& operator=(const c_outbound_queue&) = delete;
+
+	void configure(const outbound_config_t& config);
+
+	// false once the connection is too far behind to keep up
+	bool push(packet_buffer_t data, outbound_class_t cls);
+	flush_result_t flush(socket_t fd);
+
+	size_t pending(outbound_class_t cls);
+	size_t pending();
+};
+
+#endif
@@ -0,0 +1,101 @@
+#include "partition.h"
+#include "player.h"
+
+#include <unordered_map>
+
+static thread_local tick_region_t* current_region = nullptr;
+
+static size_t find_root(std::vector<size_t>& parent, size_t i)
+{
+    while (parent[i] != i)
+    {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+void partition_players(const std::vector<c_player*>& players, std::vector<tick_region_t>& regions)
+{
+    regions.clear();
+    if (players.empty())
+        return;
+
+    // Occupied cells, each starting as its own set
+    std::unordered_map<uint64_t, size_t> cells;
+    std::vector<chunk_pos_t> cell_pos;
+    std::vector<size_t> player_cell(players.size());
+
+    for (size_t i = 0; i < players.size(); i++)
+    {
+        chunk_pos_t chunk = chunk_from_block(players[i]->position.x, players[i]->position.z);
+        chunk_pos_t cell = { chunk.x >> TICK_REGION_CELL_SHIFT, chunk.z >> TICK_REGION_CELL_SHIFT };
+
+        auto it = cells.find(chunk_key(cell));
+        if (it == cells.end())
+        {
+            it = cells.emplace(chunk_key(cell), cell_pos.size()).first;
+            cell_pos.push_back(cell);
+        }
+        player_cell[i] = it->second;
+    }
+
+    std::vector<size_t> parent(cell_pos.size());
+    for (size_t i = 0; i < parent.size(); i++)
+        parent[i] = i;
+
+    for (size_t i = 0; i < cell_pos.size(); i++)
+    {
+        for (int32_t dz = -1; dz <= 1; dz++)
+        {
+            for (int32_t dx = -1; dx <= 1; dx++)
+            {
+                chunk_pos_t next = { cell_pos[i].x + dx, cell_pos[i].z + dz };
+                auto it = cells.find(chunk_key(next));
+                if (it == cells.end())
+                    continue;
+
+                size_t a = find_root(parent, i);
+                size_t b = find_root(parent, it->second);
+                if (a != b)
+                    parent[a] = b;
+            }
+        }
+    }
+
+    std::vector<size_t> region_of(cell_pos.size(), SIZE_MAX);
+    for (size_t i = 0; i < players.size(); i++)
+    {
+        size_t root = find_root(parent, player_cell[i]);
+        if (region_of[root] == SIZE_MAX)
+        {
+            region_of[root] = regions.size();
+            regions.emplace_back();
+        }
+        regions[region_of[root]].players.push_back(players[i]);
+    }
+}
+
+void tick_defer(tick_effect_t effect)
+{
+    if (current_region)
+        current_region->deferred.push_back(std::move(effect));
+    else
+        effect();
+}
+
+void tick_enter_region(tick_region_t* region)
+{
+    current_region = region;
+}
+
+void tick_merge_regions(std::vector<tick_region_t>& regions)
+{
+    // Regions are merged in a fixed order so effects apply deterministically
+    for (tick_region_t& region : regions)
+    {
+        for (tick_effect_t& effect : region.deferred)
+            effect();
+        region.deferred.clear();
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef IMPL_PARTITION_H
+#define IMPL_PARTITION_H
+
+#include <stdint.h>
+#include <vector>
+#include <functional>
+
+#include "chunk_queue.h"
+
+class c_player;
+
+// Cells of 8x8 chunks. Players in the same or in touching cells end up in
+// one region; players of different regions can't affect each other within
+// a tick, so regions are ticked in parallel.
+#define TICK_REGION_CELL_SHIFT 3
+
+typedef std::function<void()> tick_effect_t;
+
+typedef struct
+{
+	std::vector<c_player*> players;
+	chunk_budget_t budget;
+	std::vector<tick_effect_t> deferred;
+}
+tick_region_t;
+
+void partition_players(const std::vector<c_player*>& players, std::vector<tick_region_t>& regions);
+
+// Runs effect in the merge phase after all regions have been ticked when
+// called from inside a region, or right away otherwise. Anything touching
+// state outside the calling region has to go through here.
+void tick_defer(tick_effect_t effect);
+
+void tick_enter_region(tick_region_t* region);
+void tick_merge_regions(std::vector<tick_region_t>& regions);
+
+#endif
@@ -1,9 +1,14 @@
 #include "player.h"
 #include "server.h"
+#include "../world/collision.h"
 
+#include <cmath>
 #include <string>
 #include <sstream>
 
+// Chunks passed over per tick while waiting for nearer ones to load
+#define PLAYER_CHUNK_WAIT_SKIP 16
+
 void c_player::on_handshake(c_packet& packet)
 {
     switch (packet.id)
@@ -98,16 +103,8 @@ void c_player::on_login(c_packet& packet)
             static_cast<double>(server->config.spawn_z)
         };
 
-        packet_out.clear();
-        c_s2c_position_look pos_look = c_s2c_position_look
-        (
-            spawn_pos.x, spawn_pos.y, spawn_pos.z,
-            0.f, 0.f,
-            0b00000000,
-            1
-        );
-        pos_look.serialize(packet_out);
-        this->send_packet(packet_out);
+        this->view.configure(server->config.view_distance, server->config.view_shape);
+        this->teleport(spawn_pos);
 
         this->state = connection_state_t::play;
         break;
@@ -121,6 +118,14 @@ void c_player::on_play(c_packet& packet)
 
     switch (packet.id)
     {
+    case 0x00:
+    {
+        c_c2s_teleport_confirm confirm = c_c2s_teleport_confirm();
+        confirm.deserialize(packet);
+        if (confirm.teleport_id == this->teleport_id)
+            this->awaiting_teleport = false;
+        break;
+    }
     case 0x02:
     {
         c_c2s_chat_message chat_message = c_c2s_chat_message();
@@ -133,32 +138,227 @@ void c_player::on_play(c_packet& packet)
     {
         c_c2s_position pos = c_c2s_position();
         pos.deserialize(packet);
-        this->position = { pos.x, pos.y, pos.z };
-        this->on_ground = pos.on_ground;
+        vec3d_t position = { pos.x, pos.y, pos.z };
+        this->queue_movement(&position, nullptr, pos.on_ground);
         break;
     }
     case 0x0E:
     {
         c_c2s_position_look poslook = c_c2s_position_look();
         poslook.deserialize(packet);
-        this->position = { poslook.x, poslook.y, poslook.z };
-        this->rotation = { poslook.yaw,  poslook.pitch };
-        this->on_ground = poslook.on_ground;
+        vec3d_t position = { poslook.x, poslook.y, poslook.z };
+        angle_t rotation = { poslook.yaw,  poslook.pitch };
+        this->queue_movement(&position, &rotation, poslook.on_ground);
         break;
     }
     case 0x0F:
     {
         c_c2s_look look = c_c2s_look();
         look.deserialize(packet);
-        this->rotation = { look.yaw,  look.pitch };
-        this->on_ground = look.on_ground;
+        angle_t rotation = { look.yaw,  look.pitch };
+        this->queue_movement(nullptr, &rotation, look.on_ground);
         break;
     }
     }
 }
 
+void c_player::queue_movement(const vec3d_t* position, const angle_t* rotation, bool on_ground)
+{
+    // The client keeps sending its old position until it has seen our teleport
+    if (this->awaiting_teleport)
+        return;
+
+    movement_state_t& pending = this->pending_movement;
+
+    bool was_on_ground = pending.packet_count ? pending.on_ground : this->on_ground;
+    if (on_ground && !was_on_ground)
+        pending.landed = true;
+    else if (!on_ground && was_on_ground)
+        pending.left_ground = true;
+
+    if (position)
+    {
+        pending.position = *position;
+        pending.has_position = true;
+    }
+
+    if (rotation)
+    {
+        pending.rotation = *rotation;
+        pending.has_rotation = true;
+    }
+
+    pending.on_ground = on_ground;
+    pending.packet_count++;
+}
+
+void c_player::apply_movement()
+{
+    movement_state_t& pending = this->pending_movement;
+    if (pending.packet_count == 0)
+        return;
+
+    // Everything that reacts to movement runs from here, once per tick,
+    // regardless of how many movement packets arrived since the last one.
+    if (pending.has_position)
+    {
+        if (!this->validate_movement(pending.position))
+        {
+            this->teleport(this->position);
+            return;
+        }
+        this->position = pending.position;
+        this->update_view();
+    }
+    if (pending.has_rotation)
+        this->rotation = pending.rotation;
+    this->on_ground = pending.on_ground;
+
+    pending = {};
+}
+
+bool c_player::validate_movement(const vec3d_t& target)
+{
+    c_server* server = ((c_server*)this->server_ptr);
+
+    if (!std::isfinite(target.x) || !std::isfinite(target.y) || !std::isfinite(target.z))
+        return false;
+
+    if (!server->config.movement_checks)
+        return true;
+
+    double dx = target.x - this->position.x;
+    double dy = target.y - this->position.y;
+    double dz = target.z - this->position.z;
+    double max_move = server->config.max_move_per_tick;
+
+    if (dx * dx + dy * dy + dz * dz > max_move * max_move)
+    {
+        printf("%s moved too quickly (%f, %f, %f)\r\n", this->name.c_str(), dx, dy, dz);
+        return false;
+    }
+
+    if (collision_sweep(server->world, this->position, target))
+    {
+        printf("%s moved wrongly (%f, %f, %f)\r\n", this->name.c_str(), dx, dy, dz);
+        return false;
+    }
+
+    return true;
+}
+
+void c_player::teleport(const vec3d_t& target)
+{
+    this->position = target;
+    this->pending_movement = {};
+    this->awaiting_teleport = true;
+    this->teleport_id++;
+    this->update_view();
+
+    // Rotation is sent as relative so the client keeps looking where it was
+    c_packet packet;
+    c_s2c_position_look pos_look = c_s2c_position_look
+    (
+        target.x, target.y, target.z,
+        0.f, 0.f,
+        0b00011000,
+        this->teleport_id
+    );
+    pos_look.serialize(packet);
+    this->send_packet(packet, outbound_movement);
+}
+
+void c_player::update_view()
+{
+    // Only does work when the player crossed into another chunk
+    this->view.move_to(chunk_from_block(this->position.x, this->position.z));
+}
+
+void c_player::send_chunks(chunk_budget_t& budget)
+{
+    c_server* server = ((c_server*)this->server_ptr);
+
+    std::vector<view_change_t> changes;
+    this->view.take_changes(changes);
+
+    std::vector<chunk_pos_t> unloads;
+    this->chunk_queue.apply(changes, unloads);
+
+    for (chunk_pos_t pos : unloads)
+    {
+        c_packet packet;
+        c_s2c_unload_chunk unload = c_s2c_unload_chunk(pos.x, pos.z);
+        unload.serialize(packet);
+        this->send_packet(packet, outbound_bulk);
+    }
+
+    this->chunk_queue.reprioritize(this->position, this->rotation);
+
+    // A chunk is sent while any byte budget is left, the last one may overshoot
+    uint32_t chunks_left = server->config.player_chunks_per_tick;
+    size_t bytes_left = server->config.player_chunk_bytes_per_tick;
+
+    // Chunks wait in the chunk queue, where they are still reprioritized,
+    // rather than piling up in the send queue of a slow connection
+    if (this->outbound.pending(outbound_bulk) >= server->config.bulk_backlog)
+        return;
+
+    bool loading = server->chunk_loader.is_running();
+    std::vector<chunk_pos_t> waiting;
+
+    chunk_pos_t pos;
+    while (chunks_left && bytes_left && budget.chunks && budget.bytes && this->chunk_queue.pop(pos))
+    {
+        // Columns still on their way from disk keep their place in the queue;
+        // a few are skipped for ones further out that already arrived
+        if (loading && !server->world.get_chunk(pos))
+        {
+            waiting.push_back(pos);
+            if (waiting.size() >= PLAYER_CHUNK_WAIT_SKIP)
+                break;
+            continue;
+        }
+
+        packet_buffer_t packet = server->world.get_chunk_packet(pos);
+        size_t size = packet->size();
+        this->send_buffer(std::move(packet), outbound_bulk);
+        this->chunk_queue.mark_sent(pos);
+
+        chunks_left--;
+        budget.chunks--;
+        bytes_left = size >= bytes_left ? 0 : bytes_left - size;
+        budget.bytes = size >= budget.bytes ? 0 : budget.bytes - size;
+    }
+
+    for (chunk_pos_t wait : waiting)
+        this->chunk_queue.requeue(wait);
+}
+
+// Latency class of a serverbound packet, matching the outbound classes
+static outbound_class_t inbound_class(connection_state_t state, uint32_t id)
+{
+    if (state != connection_state_t::play)
+        return outbound_control;
+
+    switch (id)
+    {
+    case 0x02:
+        return outbound_chat;
+    case 0x0C:
+    case 0x0D:
+    case 0x0E:
+    case 0x0F:
+        return outbound_movement;
+    default:
+        return outbound_control;
+    }
+}
+
 void c_player::on_receive(c_packet& packet)
 {
+    if (packet.received_at)
+        c_metrics::instance().observe_latency(metrics_in, inbound_class(this->state, packet.id), monotonic_micros() - packet.received_at);
+
     try
     {
         c_server* server = ((c_server*)this->server_ptr);
@@ -195,69 +395,60 @@ void c_player::send_message(std::string& message)
     );
     chat_packet.serialize(packet);
 
-    this->send_packet(packet);
+    this->send_packet(packet, outbound_chat);
 }
 
-void c_player::send_packet(c_packet& packet)
+// Id of a finalized packet, which follows the length prefix
+static uint32_t frame_packet_id(const std::vector<uint8_t>& raw)
 {
-    if (packet.get_size() <= 1) return;
-
-    std::lock_guard<std::mutex> lock(((c_server*) this->server_ptr)->send_mutex);
+    size_t i = 0;
+    while (i < raw.size() && i < 5 && (raw[i] & 0x80))
+        i++;
 
-    auto& out = packet.get_raw();
-    printf("Sending packet of %zu bytes: ", out.size());
-    for (size_t i = 0; i < min(out.size(), size_t(20)); i++) 
+    uint32_t id = 0;
+    for (int shift = 0; ++i < raw.size() && shift <= 28; shift += 7)
     {
-        printf("%02X ", out[i]);
+        id |= (raw[i] & 0x7F) << shift;
+        if (!(raw[i] & 0x80))
+            break;
     }
+    return id;
+}
 
-    if (out.size() > 20) printf("...");
-    printf("\n");
+void c_player::send_packet(c_packet& packet, outbound_class_t cls)
+{
+    if (packet.get_size() <= 1) return;
 
-    size_t total_sent = 0;
-    size_t total_size = out.size();
+    // The queue takes over the bytes, no copy is made
+    packet_buffer_t data = std::make_shared<const std::vector<uint8_t>>(std::move(packet.get_raw()));
+    packet.clear();
+
+    this->send_buffer(std::move(data), cls);
+}
 
-    while (total_sent < total_size) 
+void c_player::send_buffer(packet_buffer_t data, outbound_class_t cls)
+{
+    c_metrics::instance().count_packet(metrics_out, this->state, frame_packet_id(*data), data->size());
+
+    if (!this->outbound.push(std::move(data), cls))
     {
-        int sent = send
-        (
-            this->client_fd,
-            reinterpret_cast<const char*>(out.data() + total_sent),
-            static_cast<int>(total_size - total_sent),
-            0
-        );
+        printf("%s can't keep up, %zu bytes queued\r\n", this->name.c_str(), this->outbound.pending());
+        this->disconnect();
+    }
+}
 
-        if (sent == SOCK_ERR_VAL) 
-        {
-#ifdef _WIN32
-            int error = WSAGetLastError();
-            if (error == WSAEWOULDBLOCK) 
-            {
-#else
-            if (errno == EWOULDBLOCK || errno == EAGAIN) 
-            {
-#endif
-                printf("Socket would block\n");
-                continue;
-            }
-            else {
+void c_player::flush_packets()
+{
+    if (this->outbound.flush(this->client_fd) == flush_error)
+        this->disconnect();
+}
+
+void c_player::disconnect()
+{
+    // The network thread sees the closed socket and removes the player
 #ifdef _WIN32
-                printf("Send failed with error: %d\n", error);
+    shutdown(this->client_fd, SD_BOTH);
 #else
-                printf("Send failed with error: %s (errno: %d)\n", strerror(errno), errno);
+    shutdown(this->client_fd, SHUT_RDWR);
 #endif
-                return;
-            }
-            }
-        else if (sent == 0) {
-            printf("Connection closed by peer\n");
-            return;
-        }
-        else {
-            total_sent += sent;
-            printf("Sent %d bytes (total: %zu/%zu)\n", sent, total_sent, total_size);
-        }
-        }
-
-    printf("Successfully sent all %zu bytes\n", total_size);
-}
\ No newline at end of file
+}
@@ -5,6 +5,9 @@
 #include "../protocol/packets.h"
 
 #include "../math/math.h"
+#include "view.h"
+#include "chunk_queue.h"
+#include "outbound.h"
 
 typedef enum
 {
@@ -23,13 +26,27 @@ typedef enum
 }
 connection_state_t;
 
+// Movement received since the last tick. Only the newest position/rotation is
+// kept; on_ground flips are accumulated so a tick still sees landings.
+typedef struct
+{
+	vec3d_t		position;
+	angle_t		rotation;
+	bool		has_position;
+	bool		has_rotation;
+	bool		on_ground;
+	bool		landed;
+	bool		left_ground;
+	uint32_t	packet_count;
+}
+movement_state_t;
+
 class c_player
 {
 private:
 public:
 	std::string			name;
 	connection_state_t	state;
-	uint64_t			last_keep_alive;
 	socket_t			client_fd;
 	void*				server_ptr;
 	uint32_t			entity_id;
@@ -38,7 +55,15 @@ public:
 	angle_t rotation;
 	bool on_ground;
 
-	c_player() : name(""), state(connection_state_t::handshake) { }
+	movement_state_t pending_movement;
+	int32_t teleport_id;
+	bool awaiting_teleport;
+	c_view_tracker view;
+	c_chunk_queue chunk_queue;
+	c_outbound_queue outbound;
+
+	c_player() : name(""), state(connection_state_t::handshake), position{}, rotation{}, on_ground(false), pending_movement{},
+		teleport_id(0), awaiting_teleport(false) { }
 	c_player(const c_player&) = delete;
 	c_player& operator=(const c_player&) = delete;
 
@@ -47,7 +72,16 @@ public:
 	void on_status(c_packet& packet);
 	void on_login(c_packet& packet);
 	void on_play(c_packet& packet);
-	void send_packet(c_packet& packet);
+	void queue_movement(const vec3d_t* position, const angle_t* rotation, bool on_ground);
+	void apply_movement();
+	bool validate_movement(const vec3d_t& target);
+	void teleport(const vec3d_t& target);
+	void update_view();
+	void send_chunks(chunk_budget_t& budget);
+	void send_packet(c_packet& packet, outbound_class_t cls = outbound_control);
+	void send_buffer(packet_buffer_t data, outbound_class_t cls);
+	void flush_packets();
+	void disconnect();
 	void send_message(std::string& message);
 };
 
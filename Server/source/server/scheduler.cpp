@@ -0,0 +1,225 @@
+#include "scheduler.h"
+
+#define ROOT_SIZE	(1 << SCHEDULER_ROOT_BITS)
+#define LEVEL_SIZE	(1 << SCHEDULER_LEVEL_BITS)
+
+// First tick delta that no longer fits below the given level
+#define LEVEL_SPAN(level) (1ull << (SCHEDULER_ROOT_BITS + SCHEDULER_LEVEL_BITS * (level)))
+
+static int32_t level_bucket(int level, uint64_t due)
+{
+    if (level == 0)
+        return static_cast<int32_t>(due & (ROOT_SIZE - 1));
+
+    int shift = SCHEDULER_ROOT_BITS + SCHEDULER_LEVEL_BITS * (level - 1);
+    return ROOT_SIZE + (level - 1) * LEVEL_SIZE + static_cast<int32_t>((due >> shift) & (LEVEL_SIZE - 1));
+}
+
+c_task_scheduler::c_task_scheduler()
+    : buckets(ROOT_SIZE + (SCHEDULER_LEVELS - 1) * LEVEL_SIZE + 1, -1), free_list(-1), tick(0), active(0)
+{
+}
+
+int32_t c_task_scheduler::allocate()
+{
+    int32_t index = this->free_list;
+    if (index >= 0)
+    {
+        this->free_list = this->entries[index].next;
+    }
+    else
+    {
+        index = static_cast<int32_t>(this->entries.size());
+        this->entries.push_back({});
+    }
+
+    timer_entry_t& entry = this->entries[index];
+    entry.bucket = -1;
+    entry.prev = -1;
+    entry.next = -1;
+    entry.active = true;
+    this->active++;
+    return index;
+}
+
+void c_task_scheduler::release(int32_t index)
+{
+    timer_entry_t& entry = this->entries[index];
+    entry.task = nullptr;
+    entry.generation++;
+    entry.active = false;
+    entry.bucket = -1;
+    entry.next = this->free_list;
+    this->free_list = index;
+    this->active--;
+}
+
+void c_task_scheduler::link(int32_t index, int32_t bucket)
+{
+    timer_entry_t& entry = this->entries[index];
+    entry.bucket = bucket;
+    entry.prev = -1;
+    entry.next = this->buckets[bucket];
+    if (entry.next >= 0)
+        this->entries[entry.next].prev = index;
+    this->buckets[bucket] = index;
+}
+
+void c_task_scheduler::unlink(int32_t index)
+{
+    timer_entry_t& entry = this->entries[index];
+    if (entry.prev >= 0)
+        this->entries[entry.prev].next = entry.next;
+    else
+        this->buckets[entry.bucket] = entry.next;
+
+    if (entry.next >= 0)
+        this->entries[entry.next].prev = entry.prev;
+
+    entry.bucket = -1;
+    entry.prev = -1;
+    entry.next = -1;
+}
+
+void c_task_scheduler::place(int32_t index)
+{
+    timer_entry_t& entry = this->entries[index];
+    if (entry.due < this->tick)
+        entry.due = this->tick;
+
+    uint64_t delta = entry.due - this->tick;
+    int level = 0;
+    while (level < SCHEDULER_LEVELS - 1 && delta >= LEVEL_SPAN(level))
+        level++;
+
+    // Too far out for the outermost wheel: park it in the last bucket it can
+    // reach, cascading will place it again with the real due tick
+    uint64_t due = entry.due;
+    if (delta >= LEVEL_SPAN(SCHEDULER_LEVELS - 1))
+        due = this->tick + LEVEL_SPAN(SCHEDULER_LEVELS - 1) - 1;
+
+    this->link(index, level_bucket(level, due));
+}
+
+bool c_task_scheduler::cascade(int level)
+{
+    int32_t bucket = level_bucket(level, this->tick);
+    int32_t index = this->buckets[bucket];
+    this->buckets[bucket] = -1;
+
+    while (index >= 0)
+    {
+        int32_t next = this->entries[index].next;
+        this->place(index);
+        index = next;
+    }
+
+    // The next wheel out only moves when this one wrapped around
+    return bucket == level_bucket(level, 0);
+}
+
+void c_task_scheduler::run_tick()
+{
+    uint64_t now = this->tick;
+    int32_t bucket = level_bucket(0, now);
+
+    if (bucket == 0)
+    {
+        for (int level = 1; level < SCHEDULER_LEVELS; level++)
+        {
+            if (!this->cascade(level))
+                break;
+        }
+    }
+
+    int32_t head = this->buckets[bucket];
+    if (head < 0)
+    {
+        this->tick = now + 1;
+        return;
+    }
+
+    // Move the due tasks aside so anything scheduled while they run lands in
+    // a later tick, and cancel() can still find them
+    int32_t running = static_cast<int32_t>(this->buckets.size()) - 1;
+    this->buckets[bucket] = -1;
+    this->buckets[running] = head;
+    for (int32_t index = head; index >= 0; index = this->entries[index].next)
+        this->entries[index].bucket = running;
+
+    this->tick = now + 1;
+
+    while (this->buckets[running] >= 0)
+    {
+        int32_t index = this->buckets[running];
+        this->unlink(index);
+
+        // The task may schedule others and grow the slab
+        scheduled_task_t task = std::move(this->entries[index].task);
+        task();
+
+        timer_entry_t& entry = this->entries[index];
+        if (entry.active && entry.period)
+        {
+            entry.task = std::move(task);
+            entry.due = now + entry.period;
+            this->place(index);
+        }
+        else
+        {
+            this->release(index);
+        }
+    }
+}
+
+task_handle_t c_task_scheduler::run_later(uint32_t delay, scheduled_task_t task)
+{
+    return this->run_repeating(delay, 0, std::move(task));
+}
+
+task_handle_t c_task_scheduler::run_repeating(uint32_t delay, uint32_t period, scheduled_task_t task)
+{
+    int32_t index = this->allocate();
+    timer_entry_t& entry = this->entries[index];
+    entry.task = std::move(task);
+    entry.due = this->tick + delay;
+    entry.period = period;
+    this->place(index);
+
+    return { static_cast<uint32_t>(index), entry.generation };
+}
+
+bool c_task_scheduler::cancel(task_handle_t handle)
+{
+    if (handle.index >= this->entries.size())
+        return false;
+
+    int32_t index = static_cast<int32_t>(handle.index);
+    timer_entry_t& entry = this->entries[index];
+    if (!entry.active || entry.generation != handle.generation)
+        return false;
+
+    // A task cancelling itself while it runs is released once it returns
+    if (entry.bucket < 0)
+    {
+        entry.active = false;
+        return true;
+    }
+
+    this->unlink(index);
+    this->release(index);
+    return true;
+}
+
+void c_task_scheduler::advance(uint64_t tick)
+{
+    while (this->tick <= tick)
+    {
+        if (this->active == 0)
+        {
+            this->tick = tick + 1;
+            return;
+        }
+        this->run_tick();
+    }
+}
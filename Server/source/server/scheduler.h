@@ -0,0 +1,77 @@
+#ifndef IMPL_SCHEDULER_H
+#define IMPL_SCHEDULER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <vector>
+
+// Bits of the innermost wheel and of each outer wheel
+#define SCHEDULER_ROOT_BITS		8
+#define SCHEDULER_LEVEL_BITS	6
+#define SCHEDULER_LEVELS		5
+
+typedef std::function<void()> scheduled_task_t;
+
+// Identifies a scheduled task, stays invalid once the task is gone
+typedef struct
+{
+	uint32_t index;
+	uint32_t generation;
+}
+task_handle_t;
+
+// Hierarchical timer wheel keyed on the tick number. A task sits in the
+// bucket of the coarsest wheel its delay needs and moves one wheel inward
+// each time the wheel below wraps around, so scheduling, cancelling and an
+// idle tick are all constant time no matter how many tasks are pending.
+// Only to be used from the tick thread.
+class c_task_scheduler
+{
+private:
+	typedef struct
+	{
+		scheduled_task_t task;
+		uint64_t due;
+		uint32_t period;		// 0 for one shot tasks
+		uint32_t generation;
+		int32_t bucket;			// -1 while running or free
+		int32_t prev;
+		int32_t next;
+		bool active;
+	}
+	timer_entry_t;
+
+	std::vector<timer_entry_t> entries;
+	std::vector<int32_t> buckets;	// list heads, the last one holds the tick being run
+	int32_t free_list;
+	uint64_t tick;					// next tick to run
+	size_t active;
+
+	int32_t allocate();
+	void release(int32_t index);
+	void link(int32_t index, int32_t bucket);
+	void unlink(int32_t index);
+	void place(int32_t index);
+	bool cascade(int level);
+	void run_tick();
+public:
+	c_task_scheduler();
+	c_task_scheduler(const c_task_scheduler&) = delete;
+	c_task_scheduler& operator=(const c_task_scheduler&) = delete;
+
+	// Delays are in ticks; a delay of 0 runs on the next advance
+	task_handle_t run_later(uint32_t delay, scheduled_task_t task);
+	task_handle_t run_repeating(uint32_t delay, uint32_t period, scheduled_task_t task);
+
+	// false if the task already ran or was cancelled
+	bool cancel(task_handle_t handle);
+
+	// Runs everything that is due up to and including the given tick
+	void advance(uint64_t tick);
+
+	uint64_t get_tick() const { return this->tick; }
+	size_t pending() const { return this->active; }
+};
+
+#endif
@@ -1,11 +1,24 @@
 #include "server.h"
 
 #include "../protocol/packets.h"
+#include "../util/profiler.h"
+#include "../util/sampler.h"
+#include "metrics.h"
+#include "../../libs/libnbt/nbt.h"
 
 #include <SimpleIni.h>
 #include <regex>
 #include <string>
 #include <sstream>
+#include <algorithm>
+#include <cstdlib>
+#include <cerrno>
+#include <unordered_map>
+#include <unordered_set>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
 std::string escape_json_string(const std::string& input) {
     std::string output;
@@ -44,15 +57,51 @@ c_server::c_server(const char* config_name)
 	long port					= ini.GetLongValue("Server", "port", 25565);
 	long max_players			= ini.GetLongValue( "Server", "max_players", 16);
     const char* motd            = ini.GetValue("Server", "motd", "");
+    long view_distance          = ini.GetLongValue("Server", "view_distance", 10);
+    const char* view_shape      = ini.GetValue("Server", "view_shape", "square");
+
+    const char* world_directory = ini.GetValue("Worlds", "overworld", "");
 
     long spawn_x = ini.GetLongValue("World", "spawn_x", 0);
     long spawn_y = ini.GetLongValue("World", "spawn_y", 64);
     long spawn_z = ini.GetLongValue("World", "spawn_z", 0);
 
+    bool movement_checks        = ini.GetBoolValue("Movement", "checks", true);
+    double max_move_per_tick    = ini.GetDoubleValue("Movement", "max_move_per_tick", 10.0);
+
+    long player_chunks          = ini.GetLongValue("Chunks", "player_chunks_per_tick", 8);
+    long player_chunk_bytes     = ini.GetLongValue("Chunks", "player_bytes_per_tick", 262144);
+    long chunks                 = ini.GetLongValue("Chunks", "chunks_per_tick", 64);
+    long chunk_bytes            = ini.GetLongValue("Chunks", "bytes_per_tick", 2097152);
+    long loader_threads         = ini.GetLongValue("Chunks", "loader_threads", 2);
+    long chunk_loads            = ini.GetLongValue("Chunks", "loads_per_tick", 64);
+    long region_cache           = ini.GetLongValue("Chunks", "region_cache", 16);
+
+    long rate_limit             = ini.GetLongValue("Network", "rate_limit", 4194304);
+    long burst                  = ini.GetLongValue("Network", "burst", 262144);
+    long send_queue_watermark   = ini.GetLongValue("Network", "send_queue_watermark", 131072);
+    long max_queued_bytes       = ini.GetLongValue("Network", "max_queued_bytes", 16777216);
+    long bulk_backlog           = ini.GetLongValue("Network", "bulk_backlog", 1048576);
+
+    long tps                    = ini.GetLongValue("Tick", "tps", 20);
+    long max_catch_up_ticks     = ini.GetLongValue("Tick", "max_catch_up_ticks", 20);
+    long worker_threads         = ini.GetLongValue("Tick", "worker_threads", -1);
+    double work_budget_ms       = ini.GetDoubleValue("Tick", "work_budget_ms", 5.0);
+    double spike_threshold_ms   = ini.GetDoubleValue("Tick", "spike_threshold_ms", 100.0);
+    long flight_recorder_ticks  = ini.GetLongValue("Tick", "flight_recorder_ticks", 600);
+    const char* spike_dir       = ini.GetValue("Tick", "spike_dir", "spikes");
+    long watchdog_seconds       = ini.GetLongValue("Tick", "watchdog_seconds", 10);
+
+    long metrics_port           = ini.GetLongValue("Metrics", "port", 9225);
+
+    long sample_hz              = ini.GetLongValue("Profiler", "sample_hz", 99);
+
 
 	this->config.port			= port > UINT16_MAX ? UINT16_MAX : port;
 	this->config.max_players	= max_players > UINT8_MAX ? UINT8_MAX : max_players;
     this->config.motd           = std::string(motd);
+    this->config.view_distance  = view_distance < 2 ? 2 : (view_distance > 32 ? 32 : view_distance);
+    this->config.view_shape     = std::string(view_shape) == "circle" ? view_circle : view_square;
 
     std::ostringstream oss;
 
@@ -72,8 +121,53 @@ c_server::c_server(const char* config_name)
     this->config.spawn_y = spawn_y;
     this->config.spawn_z = spawn_z;
 
+    this->config.movement_checks = movement_checks;
+    this->config.max_move_per_tick = max_move_per_tick;
+
+    this->config.player_chunks_per_tick = player_chunks < 1 ? 1 : player_chunks;
+    this->config.player_chunk_bytes_per_tick = player_chunk_bytes < 1 ? 1 : player_chunk_bytes;
+    this->config.chunks_per_tick = chunks < 1 ? 1 : chunks;
+    this->config.chunk_bytes_per_tick = chunk_bytes < 1 ? 1 : chunk_bytes;
+    this->config.world_directory = std::string(world_directory);
+    this->config.loader_threads = loader_threads < 1 ? 1 : (loader_threads > 64 ? 64 : loader_threads);
+    this->config.chunk_loads_per_tick = chunk_loads < 1 ? 1 : chunk_loads;
+    this->config.region_cache_size = region_cache < 1 ? 1 : region_cache;
+
+    this->config.outbound.rate = rate_limit < 0 ? 0 : rate_limit;
+    this->config.outbound.burst = burst < 1 ? 1 : burst;
+    this->config.outbound.watermark = send_queue_watermark < 0 ? 0 : send_queue_watermark;
+    this->config.outbound.max_queued = max_queued_bytes < 0 ? 0 : max_queued_bytes;
+    this->config.bulk_backlog = bulk_backlog < 1 ? 1 : bulk_backlog;
+
+    this->config.tps = tps < 1 ? 1 : (tps > 1000 ? 1000 : tps);
+    this->config.max_catch_up_ticks = max_catch_up_ticks < 0 ? 0 : max_catch_up_ticks;
+    this->tick_scheduler.configure(this->config.tps, this->config.max_catch_up_ticks);
+    this->tick_stats.configure(this->config.tps);
+
+    // The tick thread works alongside the pool, so leave it a core
+    if (worker_threads < 0)
+    {
+        long cores = static_cast<long>(std::thread::hardware_concurrency());
+        worker_threads = cores > 1 ? cores - 1 : 0;
+    }
+    this->config.worker_threads = worker_threads > 64 ? 64 : worker_threads;
+    this->config.work_budget_ms = work_budget_ms < 0.0 ? 0.0 : work_budget_ms;
+    this->flight_recorder.configure(
+        flight_recorder_ticks < 1 ? 1 : (flight_recorder_ticks > 72000 ? 72000 : flight_recorder_ticks),
+        static_cast<float>(spike_threshold_ms), spike_dir);
+    this->watchdog.configure(watchdog_seconds < 0 ? 0 : watchdog_seconds);
+
+    this->config.metrics_port = metrics_port < 0 || metrics_port > UINT16_MAX ? 0 : metrics_port;
+    this->config.sample_hz = sample_hz < 1 ? 1 : (sample_hz > SAMPLER_MAX_HZ ? SAMPLER_MAX_HZ : sample_hz);
+
 	printf("Port: %d\n", this->config.port);
 	printf("Max Players: %d\n", this->config.max_players);
+	printf("View Distance: %d\n", this->config.view_distance);
+	printf("Tick Workers: %u\n", this->config.worker_threads);
+    if (this->config.world_directory.empty())
+        printf("World: none, chunks are sent empty\n");
+    else
+        printf("World: %s (%u loader threads)\n", this->config.world_directory.c_str(), this->config.loader_threads);
     ini.Reset();
 }
 
@@ -114,7 +208,16 @@ int c_server::run()
         return 1;
     }
 
-    fd_set master_set, read_fds;
+    if (this->config.metrics_port)
+    {
+        this->register_routes();
+        if (this->metrics_endpoint.open(this->config.metrics_port))
+            printf("Metrics on port %d\r\n", this->config.metrics_port);
+        else
+            printf("Metrics listener failed on port %d\r\n", this->config.metrics_port);
+    }
+
+    fd_set master_set, read_fds, write_fds;
     FD_ZERO(&master_set);
     FD_SET(server_fd, &master_set);
     int max_fd = server_fd;
@@ -123,22 +226,54 @@ int c_server::run()
 
     this->running = true;
 
+    this->register_commands();
+    this->console.start();
+
+    this->schedule_tasks();
+
+    this->workers.start(this->config.worker_threads);
+    if (!this->config.world_directory.empty())
+        this->chunk_loader.start(this->config.world_directory, this->config.loader_threads, this->config.region_cache_size);
     this->update_thread = std::thread(&c_server::loop, this);
 
+    c_profiler::instance().set_thread_name("network");
+    c_sampler::instance().register_current_thread("network");
+    this->watchdog.watch_current_thread("network");
+    this->watchdog.start();
+
     while (this->running) {
         read_fds = master_set; // Copy the set
+        FD_ZERO(&write_fds);
 
-        int activity = select(max_fd + 1, &read_fds, nullptr, nullptr, nullptr);
+        int select_max = max_fd;
+        bool waiting = this->metrics_endpoint.prepare(read_fds, write_fds, select_max);
+
+        // A scrape answered in the background is sent within 10 ms of being done
+        timeval poll = { 0, 10000 };
+
+        int activity;
+        {
+            PROFILE_SCOPE("select");
+            activity = select(select_max + 1, &read_fds, &write_fds, nullptr, waiting ? &poll : nullptr);
+        }
         if (activity < 0) {
+#ifndef _WIN32
+            // Stack sampling interrupts the thread with a signal
+            if (errno == EINTR)
+                continue;
+#endif
             printf("select() failed\r\n");
             break;
         }
 
+        this->metrics_endpoint.process(read_fds, write_fds);
+
         for (int fd = 0; fd <= max_fd; ++fd) {
             if (!FD_ISSET(fd, &read_fds)) continue;
 
             if (fd == server_fd) {
                 // New client
+                PROFILE_SCOPE("accept");
                 sockaddr_in client_addr{};
                 socklen_t client_len = sizeof(client_addr);
                 socket_t client_fd = accept(server_fd,
@@ -159,14 +294,17 @@ int c_server::run()
             }
             else {
                 // Existing client data
+                PROFILE_SCOPE("receive");
                 std::vector<uint8_t> buffer(4096);
                 int bytes_read = recv(fd, reinterpret_cast<char*>(buffer.data()), buffer.size(), 0);
+                uint64_t received_at = monotonic_micros();
                 if (bytes_read <= 0) {
                     printf("Client disconnected\r\n");
                     CLOSE_SOCKET(fd);
                     FD_CLR(fd, &master_set);
                     client_buffers.erase(fd);
 
+                    std::lock_guard<std::mutex> lock(this->players_mutex);
                     auto player_it = this->players.find(fd);
                     if (player_it != this->players.end()) {
                         player_it->second.state = connection_state_t::handshake;
@@ -181,6 +319,8 @@ int c_server::run()
                     auto& data_buf = client_buffers[fd];
                     data_buf.insert(data_buf.end(), buffer.begin(), buffer.begin() + bytes_read);
 
+                    std::lock_guard<std::mutex> lock(this->players_mutex);
+
                     // Inline packet processing logic
                     while (true) {
                         if (data_buf.empty()) break;
@@ -212,21 +352,41 @@ int c_server::run()
                                 data_buf.begin() + varint_len + length);
                             data_buf.erase(data_buf.begin(), data_buf.begin() + varint_len + length);
 
+                            PROFILE_SCOPE("dispatch");
                             c_packet packet(packet_bytes);
                             packet.id = packet.read_var_int();
+                            packet.received_at = received_at;
 
                             if (players.find(fd) == players.end()) {
                                 this->players[fd].server_ptr = this;
                                 this->players[fd].client_fd = fd;
+                                this->players[fd].outbound.configure(this->config.outbound);
                             }
 
+                            c_metrics::instance().count_packet(metrics_in, this->players[fd].state, packet.id, packet_bytes.size());
+
+                            tick_clock_t::time_point handler_start = tick_clock_t::now();
                             this->players[fd].on_receive(packet);
+
+                            float handler_ms = std::chrono::duration<float, std::milli>(tick_clock_t::now() - handler_start).count();
+                            if (handler_ms >= FLIGHT_SLOW_MS)
+                            {
+                                char name[32];
+                                snprintf(name, sizeof(name), "packet 0x%02X", packet.id);
+                                this->flight_recorder.note_slow(name, handler_ms);
+                            }
                         }
                         catch (const std::exception& e) {
                             printf("Error: %s\r\n", e.what());
                             break;
                         }
                     }
+
+                    // Answers to handshake, status and login should not wait for the tick
+                    PROFILE_SCOPE("flush");
+                    auto player_it = this->players.find(fd);
+                    if (player_it != this->players.end())
+                        player_it->second.flush_packets();
                 }
             }
         }
@@ -237,6 +397,10 @@ int c_server::run()
     if (this->update_thread.joinable()) {
         this->update_thread.join();
     }
+    this->workers.stop();
+    this->chunk_loader.stop();
+    this->watchdog.stop();
+    this->metrics_endpoint.stop();
 
 #ifdef _WIN32
     WSACleanup();
@@ -251,45 +415,282 @@ static inline uint64_t get_unix_millis() {
         ).count();
 }
 
-static inline void sleep_until_millis(uint64_t target_millis) {
-    auto target_time = std::chrono::system_clock::time_point(
-        std::chrono::milliseconds(target_millis)
-    );
-    std::this_thread::sleep_until(target_time);
-}
-
 void c_server::loop()
 {
-    const auto interval = 50; // 20 times per second
-    uint64_t next_time = get_unix_millis();
+    c_profiler::instance().set_thread_name("tick");
+    c_sampler::instance().register_current_thread("tick");
+    this->watchdog.watch_current_thread("tick");
+    this->watchdog.beat(this->current_tick);
+    this->tick_scheduler.start();
 
     while (this->running) {
-        this->update();
+        tick_clock_t::time_point start = tick_clock_t::now();
+        {
+            PROFILE_SCOPE("tick");
+            this->update();
+
+            // Background jobs get what is left of their budget, but never more
+            // than the rest of this tick's slot
+            PROFILE_SCOPE("background jobs");
+            tick_clock_t::time_point jobs_start = tick_clock_t::now();
+            tick_clock_t::time_point deadline = std::min(
+                jobs_start + std::chrono::duration_cast<tick_clock_t::duration>(std::chrono::duration<double, std::milli>(this->config.work_budget_ms)),
+                start + this->tick_scheduler.get_interval());
+            this->jobs.run(deadline);
+            this->flight.phase_ms[flight_jobs] = std::chrono::duration<float, std::milli>(tick_clock_t::now() - jobs_start).count();
+        }
 
-        next_time += interval;
-        sleep_until_millis(next_time);
+        tick_clock_t::duration duration = tick_clock_t::now() - start;
+        this->tick_stats.record(start, duration);
+        c_metrics::instance().observe_mspt(std::chrono::duration<double, std::milli>(duration).count());
+
+        this->flight.tick = this->current_tick;
+        this->flight.total_ms = std::chrono::duration<float, std::milli>(duration).count();
+        this->flight.jobs_queued = static_cast<uint32_t>(this->jobs.size());
+        this->record_flight();
+
+        this->current_tick++;
+        this->watchdog.beat(this->current_tick);
+
+        uint32_t skipped = this->tick_scheduler.wait();
+        if (skipped)
+        {
+            printf("Can't keep up! Skipping %u ticks\r\n", skipped);
+            this->tick_stats.record_skipped(skipped);
+        }
     }
+
+    c_sampler::instance().unregister_current_thread();
 }
 
 void c_server::update()
 {
-    const uint64_t keep_alive_interval = 20000;
-    uint64_t now = get_unix_millis();
+    std::lock_guard<std::mutex> lock(this->players_mutex);
+
+    tick_clock_t::time_point mark = tick_clock_t::now();
+    auto lap = [this, &mark](flight_phase_t phase)
+    {
+        tick_clock_t::time_point now = tick_clock_t::now();
+        this->flight.phase_ms[phase] = std::chrono::duration<float, std::milli>(now - mark).count();
+        mark = now;
+    };
+
+    {
+        PROFILE_SCOPE("scheduled tasks");
+        this->tasks.advance(this->current_tick);
+    }
+    lap(flight_tasks);
+
+    this->update_chunk_loading();
+    lap(flight_chunk_loads);
+
+    std::vector<c_player*> active;
+    {
+        PROFILE_SCOPE("partition");
+        this->flight.send_queue_bytes = 0;
+        this->flight.chunks_queued = 0;
+
+        for (auto& x : this->players)
+        {
+            if (x.second.state == connection_state_t::play)
+                active.push_back(&x.second);
+            else
+                x.second.flush_packets();
+
+            this->flight.send_queue_bytes += x.second.outbound.pending();
+            this->flight.chunks_queued += static_cast<uint32_t>(x.second.chunk_queue.size());
+        }
+
+        partition_players(active, this->regions);
+    }
+    lap(flight_partition);
+
+    this->flight.players = static_cast<uint32_t>(active.size());
+    this->flight.regions = static_cast<uint32_t>(this->regions.size());
+
+    // Each region gets its share of the global chunk budget up front, so
+    // regions never have to coordinate while they run. What rounding leaves
+    // over is handed out one at a time, starting at a different region every
+    // tick, so the shares never add up to more than the budget.
+    uint32_t chunks_left = this->config.chunks_per_tick;
+    size_t bytes_left = this->config.chunk_bytes_per_tick;
+    for (tick_region_t& region : this->regions)
+    {
+        size_t share = region.players.size();
+        region.budget.chunks = static_cast<uint32_t>(this->config.chunks_per_tick * share / active.size());
+        region.budget.bytes = static_cast<size_t>(this->config.chunk_bytes_per_tick) * share / active.size();
+        chunks_left -= region.budget.chunks;
+        bytes_left -= region.budget.bytes;
+    }
+
+    size_t region_count = this->regions.size();
+    for (size_t i = 0; i < region_count && (chunks_left || bytes_left); i++)
+    {
+        chunk_budget_t& budget = this->regions[(this->chunk_cursor + i) % region_count].budget;
+        if (chunks_left)
+        {
+            budget.chunks++;
+            chunks_left--;
+        }
+        if (bytes_left)
+        {
+            budget.bytes++;
+            bytes_left--;
+        }
+    }
+
+    std::vector<pool_task_t> tasks;
+    tasks.reserve(this->regions.size());
+    for (tick_region_t& region : this->regions)
+        tasks.push_back([this, &region] { this->tick_region(region); });
+    this->workers.run(tasks);
+    lap(flight_regions);
+
+    PROFILE_SCOPE("merge");
+    tick_merge_regions(this->regions);
+    this->chunk_cursor++;
+    lap(flight_merge);
+}
+
+void c_server::update_chunk_loading()
+{
+    if (!this->chunk_loader.is_running())
+        return;
+
+    PROFILE_SCOPE("chunk loading");
 
+    // Region workers only read the world, so finished columns go in here
+    // before they start
+    std::vector<std::unique_ptr<c_chunk>> loaded;
+    this->chunk_loader.collect(loaded, this->config.chunk_loads_per_tick);
+    for (std::unique_ptr<c_chunk>& chunk : loaded)
+        this->world.add_chunk(std::move(chunk));
+
+    // Columns players are still waiting for, by squared distance to the
+    // nearest of them
+    std::unordered_map<uint64_t, uint32_t> wanted;
     for (auto& x : this->players)
     {
         c_player& player = x.second;
+        if (player.state != connection_state_t::play)
+            continue;
 
-        if ((now - player.last_keep_alive) >= keep_alive_interval)
+        chunk_pos_t center = chunk_from_block(player.position.x, player.position.z);
+        for (uint64_t key : player.chunk_queue.get_queued())
         {
-            c_s2c_keep_alive keepalive = c_s2c_keep_alive(now);
-            c_packet packet;
-            keepalive.serialize(packet);
-            player.send_packet(packet);
+            chunk_pos_t pos = chunk_from_key(key);
+            if (this->world.get_chunk(pos))
+                continue;
+
+            int64_t dx = static_cast<int64_t>(pos.x) - center.x;
+            int64_t dz = static_cast<int64_t>(pos.z) - center.z;
+            uint32_t distance = static_cast<uint32_t>(std::min<int64_t>(dx * dx + dz * dz, UINT32_MAX));
 
-            player.last_keep_alive = now;
+            auto entry = wanted.emplace(key, distance);
+            if (!entry.second && distance < entry.first->second)
+                entry.first->second = distance;
         }
     }
+
+    this->chunk_loader.update(wanted);
+}
+
+void c_server::unload_chunks()
+{
+    // Anything no client has or is about to get. Nothing is saved yet, so
+    // edits to a dropped column are lost
+    std::unordered_set<uint64_t> keep;
+    for (auto& x : this->players)
+    {
+        const c_chunk_queue& queue = x.second.chunk_queue;
+        keep.insert(queue.get_queued().begin(), queue.get_queued().end());
+        keep.insert(queue.get_sent().begin(), queue.get_sent().end());
+    }
+
+    this->world.remove_chunks_except(keep);
+}
+
+void c_server::record_flight()
+{
+    uint64_t packets[metrics_directions], bytes[metrics_directions];
+    c_metrics::instance().get_totals(packets, bytes);
+
+    this->flight.packets_in = packets[metrics_in] - this->flight_packets[metrics_in];
+    this->flight.packets_out = packets[metrics_out] - this->flight_packets[metrics_out];
+    this->flight.bytes_in = bytes[metrics_in] - this->flight_bytes[metrics_in];
+    this->flight.bytes_out = bytes[metrics_out] - this->flight_bytes[metrics_out];
+
+    for (int d = 0; d < metrics_directions; d++)
+    {
+        this->flight_packets[d] = packets[d];
+        this->flight_bytes[d] = bytes[d];
+    }
+
+    this->flight_recorder.record(this->flight);
+    this->flight = {};
+}
+
+void c_server::tick_region(tick_region_t& region)
+{
+    PROFILE_SCOPE("region");
+    tick_clock_t::time_point start = tick_clock_t::now();
+    tick_enter_region(&region);
+
+    {
+        PROFILE_SCOPE("player movement");
+        for (c_player* player : region.players)
+            player->apply_movement();
+    }
+
+    {
+        // Start at a different player every tick so nobody is starved of the
+        // budget when many players are waiting for chunks
+        PROFILE_SCOPE("chunk sending");
+        size_t count = region.players.size();
+        for (size_t i = 0; i < count; i++)
+            region.players[(this->chunk_cursor + i) % count]->send_chunks(region.budget);
+    }
+
+    {
+        PROFILE_SCOPE("flush");
+        for (c_player* player : region.players)
+            player->flush_packets();
+    }
+
+    tick_enter_region(nullptr);
+
+    float ms = std::chrono::duration<float, std::milli>(tick_clock_t::now() - start).count();
+    if (ms >= FLIGHT_SLOW_MS)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "region(%zu players)", region.players.size());
+        this->flight_recorder.note_slow(name, ms);
+    }
+}
+
+void c_server::schedule_tasks()
+{
+    const uint32_t keep_alive_interval = 15 * this->config.tps;
+
+    this->tasks.run_repeating(this->config.tps, this->config.tps, [this]()
+    {
+        this->unload_chunks();
+    });
+
+    this->tasks.run_repeating(keep_alive_interval, keep_alive_interval, [this]()
+    {
+        c_s2c_keep_alive keepalive = c_s2c_keep_alive(get_unix_millis());
+
+        for (auto& x : this->players)
+        {
+            if (x.second.state != connection_state_t::play)
+                continue;
+
+            c_packet packet;
+            keepalive.serialize(packet);
+            x.second.send_packet(packet, outbound_control);
+        }
+    });
 }
 
 void c_server::broadcast(std::string& message)
@@ -301,3 +702,312 @@ void c_server::broadcast(std::string& message)
 
     this->chat_messages.push_back(message);
 }
+
+
+void c_server::render_metrics(std::string& out)
+{
+    char labels[64];
+    size_t states[METRICS_STATES] = {};
+    size_t queued[outbound_class_count] = {};
+    size_t largest_queue = 0;
+    size_t chunks_sent = 0, chunks_queued = 0, columns = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(this->players_mutex);
+        columns = this->world.get_chunk_count();
+
+        for (auto& x : this->players)
+        {
+            c_player& player = x.second;
+            if (player.state >= 0 && player.state < METRICS_STATES)
+                states[player.state]++;
+
+            for (int cls = 0; cls < outbound_class_count; cls++)
+                queued[cls] += player.outbound.pending(static_cast<outbound_class_t>(cls));
+
+            size_t pending = player.outbound.pending();
+            if (pending > largest_queue)
+                largest_queue = pending;
+
+            chunks_sent += player.chunk_queue.sent_count();
+            chunks_queued += player.chunk_queue.size();
+        }
+    }
+
+    metrics_header(out, "mc_players_online", "gauge", "Players in play state");
+    metrics_value(out, "mc_players_online", nullptr, static_cast<double>(states[connection_state_t::play]));
+
+    metrics_header(out, "mc_connections", "gauge", "Connections by protocol state");
+    for (int i = 0; i < METRICS_STATES; i++)
+    {
+        snprintf(labels, sizeof(labels), "state=\"%s\"", metrics_state_name(i));
+        metrics_value(out, "mc_connections", labels, static_cast<double>(states[i]));
+    }
+
+    metrics_header(out, "mc_send_queue_bytes", "gauge", "Bytes waiting in send queues by priority class");
+    for (int i = 0; i < outbound_class_count; i++)
+    {
+        snprintf(labels, sizeof(labels), "class=\"%s\"", outbound_class_name(static_cast<outbound_class_t>(i)));
+        metrics_value(out, "mc_send_queue_bytes", labels, static_cast<double>(queued[i]));
+    }
+
+    metrics_header(out, "mc_send_queue_largest_bytes", "gauge", "Largest single connection send queue");
+    metrics_value(out, "mc_send_queue_largest_bytes", nullptr, static_cast<double>(largest_queue));
+
+    metrics_header(out, "mc_chunks_loaded", "gauge", "Chunks sent to and still loaded by clients");
+    metrics_value(out, "mc_chunks_loaded", nullptr, static_cast<double>(chunks_sent));
+
+    metrics_header(out, "mc_chunks_queued", "gauge", "Chunks waiting to be sent");
+    metrics_value(out, "mc_chunks_queued", nullptr, static_cast<double>(chunks_queued));
+
+    const chunk_cache_stats_t& cache = this->world.get_cache_stats();
+
+    metrics_header(out, "mc_chunk_columns", "gauge", "Chunk columns held in memory");
+    metrics_value(out, "mc_chunk_columns", nullptr, static_cast<double>(columns));
+
+    metrics_header(out, "mc_chunk_packets_total", "counter", "Chunk data packets handed out, from the cache or freshly encoded");
+    metrics_value(out, "mc_chunk_packets_total", "result=\"hit\"", static_cast<double>(cache.packet_hits.load()));
+    metrics_value(out, "mc_chunk_packets_total", "result=\"encoded\"", static_cast<double>(cache.packet_builds.load()));
+
+    metrics_header(out, "mc_chunk_packet_cache_bytes", "gauge", "Bytes of encoded chunk packets kept for reuse");
+    metrics_value(out, "mc_chunk_packet_cache_bytes", nullptr, static_cast<double>(cache.cached_bytes.load()));
+
+    const chunk_load_stats_t& loads = this->chunk_loader.get_stats();
+
+    metrics_header(out, "mc_chunk_loads_total", "counter", "Chunk columns requested from the world directory by outcome");
+    metrics_value(out, "mc_chunk_loads_total", "result=\"loaded\"", static_cast<double>(loads.loaded.load()));
+    metrics_value(out, "mc_chunk_loads_total", "result=\"missing\"", static_cast<double>(loads.missing.load()));
+    metrics_value(out, "mc_chunk_loads_total", "result=\"failed\"", static_cast<double>(loads.failed.load()));
+    metrics_value(out, "mc_chunk_loads_total", "result=\"cancelled\"", static_cast<double>(loads.cancelled.load()));
+
+    metrics_header(out, "mc_chunk_loads_pending", "gauge", "Chunk loads queued, running or waiting for the tick thread");
+    metrics_value(out, "mc_chunk_loads_pending", nullptr, static_cast<double>(this->chunk_loader.get_pending()));
+
+    metrics_header(out, "mc_region_files_open", "gauge", "Region files currently mapped");
+    metrics_value(out, "mc_region_files_open", nullptr, static_cast<double>(this->chunk_loader.get_open_regions()));
+
+    NBT_Inflate_Stats inflate;
+    NBT_Get_Inflate_Stats(&inflate);
+
+    metrics_header(out, "mc_nbt_inflate_total", "counter", "NBT inflates; retried ones guessed the output size too small and ran again");
+    metrics_value(out, "mc_nbt_inflate_total", "result=\"ok\"", static_cast<double>(inflate.calls - inflate.retries));
+    metrics_value(out, "mc_nbt_inflate_total", "result=\"retried\"", static_cast<double>(inflate.retries));
+    metrics_value(out, "mc_nbt_inflate_total", "result=\"failed\"", static_cast<double>(inflate.failures));
+
+    metrics_header(out, "mc_nbt_inflate_bytes_total", "counter", "Bytes through NBT inflate");
+    metrics_value(out, "mc_nbt_inflate_bytes_total", "side=\"compressed\"", static_cast<double>(inflate.bytes_in));
+    metrics_value(out, "mc_nbt_inflate_bytes_total", "side=\"inflated\"", static_cast<double>(inflate.bytes_out));
+
+    metrics_header(out, "mc_ticks_total", "counter", "Ticks run");
+    metrics_value(out, "mc_ticks_total", nullptr, static_cast<double>(this->tick_stats.get_total_ticks()));
+
+    metrics_header(out, "mc_ticks_skipped_total", "counter", "Ticks skipped after falling behind");
+    metrics_value(out, "mc_ticks_skipped_total", nullptr, static_cast<double>(this->tick_stats.get_skipped_ticks()));
+
+    metrics_header(out, "mc_tick_pool_steals_total", "counter", "Region tasks a tick worker took from another worker's deque");
+    metrics_value(out, "mc_tick_pool_steals_total", nullptr, static_cast<double>(this->workers.get_steals()));
+
+    std::vector<job_status_t> jobs;
+    this->jobs.get_status(jobs);
+    metrics_header(out, "mc_jobs_queued", "gauge", "Background jobs waiting to finish");
+    metrics_value(out, "mc_jobs_queued", nullptr, static_cast<double>(jobs.size()));
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 heap = mallinfo2();
+    metrics_header(out, "mc_heap_bytes", "gauge", "malloc arena bytes by use");
+    metrics_value(out, "mc_heap_bytes", "kind=\"arena\"", static_cast<double>(heap.arena));
+    metrics_value(out, "mc_heap_bytes", "kind=\"mmap\"", static_cast<double>(heap.hblkhd));
+    metrics_value(out, "mc_heap_bytes", "kind=\"in_use\"", static_cast<double>(heap.uordblks));
+    metrics_value(out, "mc_heap_bytes", "kind=\"free\"", static_cast<double>(heap.fordblks));
+    metrics_value(out, "mc_heap_bytes", "kind=\"releasable\"", static_cast<double>(heap.keepcost));
+#endif
+
+    c_metrics::instance().render(out);
+}
+
+void c_server::register_routes()
+{
+    this->metrics_endpoint.route("/metrics", [this](const std::string&, std::string& body)
+    {
+        this->render_metrics(body);
+        return 200;
+    });
+
+    // GET /debug/profile/start?hz=199, then /debug/profile/stop returns the
+    // folded stacks, e.g. curl host:9225/debug/profile/stop | flamegraph.pl
+    this->metrics_endpoint.route("/debug/profile/start", [this](const std::string& query, std::string& body)
+    {
+        uint32_t hz = this->config.sample_hz;
+        if (query.compare(0, 3, "hz=") == 0)
+            hz = static_cast<uint32_t>(strtoul(query.c_str() + 3, nullptr, 10));
+        if (!hz)
+        {
+            body = "hz must be a positive number\n";
+            return 400;
+        }
+
+        std::string error;
+        if (!c_sampler::instance().start(hz, error))
+        {
+            body = error + "\n";
+            return 409;
+        }
+        body = "sampling at " + std::to_string(c_sampler::instance().get_hz()) + " Hz\n";
+        return 200;
+    });
+
+    // Looking up the symbols of every sampled address can take seconds, so
+    // it runs off the network thread
+    this->metrics_endpoint.route("/debug/profile/stop", [](const std::string&, std::string& body)
+    {
+        if (!c_sampler::instance().stop(body))
+        {
+            body = "not sampling\n";
+            return 409;
+        }
+        return 200;
+    }, true);
+}
+
+static void print_tick_report(const char* label, const tick_report_t& report)
+{
+    printf("%-4s TPS %5.2f | MSPT mean %6.2f p50 %6.2f p95 %6.2f p99 %6.2f max %6.2f (%zu ticks)\r\n",
+        label, report.tps, report.mspt_mean, report.mspt_p50, report.mspt_p95, report.mspt_p99, report.mspt_max, report.samples);
+}
+
+void c_server::register_commands()
+{
+    this->console.register_command("help", "help - list commands", [this](const std::vector<std::string>&)
+    {
+        this->console.print_help();
+    });
+
+    auto tps = [this](const std::vector<std::string>&)
+    {
+        print_tick_report("5s", this->tick_stats.report(this->config.tps * 5));
+        print_tick_report("1m", this->tick_stats.report(this->config.tps * 60));
+        printf("Ticks %llu, skipped %llu, overran %llu\r\n",
+            (unsigned long long)this->tick_stats.get_total_ticks(),
+            (unsigned long long)this->tick_stats.get_skipped_ticks(),
+            (unsigned long long)this->tick_stats.get_overruns());
+    };
+    this->console.register_command("tps", "tps - tick rate and tick duration percentiles", tps);
+    this->console.register_command("mspt", "mspt - same as tps", tps);
+
+    this->console.register_command("profiler", "profiler <start|stop> [file] - record tick phases as Chrome trace JSON", [this](const std::vector<std::string>& args)
+    {
+        c_profiler& profiler = c_profiler::instance();
+
+        if (args.size() >= 2 && args[1] == "start")
+        {
+            profiler.start();
+            printf("Profiling started\r\n");
+        }
+        else if (args.size() >= 2 && args[1] == "stop")
+        {
+            const char* path = args.size() >= 3 ? args[2].c_str() : "trace.json";
+            size_t events = 0;
+            profiler.stop();
+
+            if (profiler.dump(path, &events))
+                printf("Wrote %zu events to %s, open it in ui.perfetto.dev or chrome://tracing\r\n", events, path);
+            else
+                printf("Failed to write %s\r\n", path);
+        }
+        else
+        {
+            printf("Profiler is %s\r\n", profiler.is_enabled() ? "running" : "stopped");
+        }
+    });
+
+    this->console.register_command("sample", "sample <start [hz]|stop [file]> - sample thread stacks, written as folded stacks for flame graphs", [this](const std::vector<std::string>& args)
+    {
+        c_sampler& sampler = c_sampler::instance();
+
+        if (args.size() >= 2 && args[1] == "start")
+        {
+            uint32_t hz = args.size() >= 3 ? static_cast<uint32_t>(strtoul(args[2].c_str(), nullptr, 10)) : this->config.sample_hz;
+            std::string error;
+            if (!hz)
+                printf("Usage: sample start [hz]\r\n");
+            else if (sampler.start(hz, error))
+                printf("Sampling at %u Hz\r\n", sampler.get_hz());
+            else
+                printf("Sampling failed: %s\r\n", error.c_str());
+        }
+        else if (args.size() >= 2 && args[1] == "stop")
+        {
+            const char* path = args.size() >= 3 ? args[2].c_str() : "profile.folded";
+            std::string folded;
+            size_t samples = 0, dropped = 0;
+            if (!sampler.stop(folded, &samples, &dropped))
+            {
+                printf("Not sampling\r\n");
+                return;
+            }
+
+            FILE* file = fopen(path, "w");
+            if (!file)
+            {
+                printf("Failed to write %s\r\n", path);
+                return;
+            }
+            fwrite(folded.data(), 1, folded.size(), file);
+            fclose(file);
+            printf("Wrote %zu samples to %s (%zu dropped), render it with flamegraph.pl or speedscope\r\n", samples, path, dropped);
+        }
+        else
+        {
+            printf("Sampler is %s\r\n", sampler.is_running() ? "running" : "stopped");
+        }
+    });
+
+    this->console.register_command("latency", "latency - packet latency percentiles in microseconds", [this](const std::vector<std::string>&)
+    {
+        static const char* directions[metrics_directions] = { "in  (recv -> dispatch)", "out (queued -> kernel)" };
+        c_histogram histogram;
+
+        for (int d = 0; d < metrics_directions; d++)
+        {
+            printf("%s\r\n", directions[d]);
+            for (int cls = 0; cls < outbound_class_count; cls++)
+            {
+                c_metrics::instance().get_latency(static_cast<metrics_direction_t>(d), static_cast<outbound_class_t>(cls), histogram);
+                if (!histogram.get_count())
+                    continue;
+
+                printf("  %-9s p50 %8llu p90 %8llu p99 %8llu p99.9 %8llu max %8llu (%llu packets)\r\n",
+                    outbound_class_name(static_cast<outbound_class_t>(cls)),
+                    (unsigned long long)histogram.percentile(0.5), (unsigned long long)histogram.percentile(0.9),
+                    (unsigned long long)histogram.percentile(0.99), (unsigned long long)histogram.percentile(0.999),
+                    (unsigned long long)histogram.get_max(), (unsigned long long)histogram.get_count());
+            }
+        }
+    });
+
+    this->console.register_command("flight", "flight - write the flight recorder's recent ticks to a file", [this](const std::vector<std::string>&)
+    {
+        this->flight_recorder.request_dump();
+    });
+
+    this->console.register_command("jobs", "jobs [cancel <id>] - list or cancel background jobs", [this](const std::vector<std::string>& args)
+    {
+        if (args.size() >= 3 && args[1] == "cancel")
+        {
+            uint64_t id = strtoull(args[2].c_str(), nullptr, 10);
+            printf(this->jobs.cancel(id) ? "Cancelling job %llu\r\n" : "No job %llu\r\n", (unsigned long long)id);
+            return;
+        }
+
+        std::vector<job_status_t> status;
+        this->jobs.get_status(status);
+        printf("%zu queued, %llu completed, budget %.2f ms per tick\r\n",
+            status.size(), (unsigned long long)this->jobs.get_completed(), this->config.work_budget_ms);
+        for (const job_status_t& job : status)
+        {
+            printf("  #%llu %-20s %5.1f%% %8llu steps %6u ticks %9.2f ms (slowest step %.3f ms)\r\n",
+                (unsigned long long)job.id, job.name.c_str(), job.progress * 100.f, (unsigned long long)job.steps,
+                job.ticks, job.time_ms, job.slowest_step_ms);
+        }
+    });
+}
\ No newline at end of file
@@ -9,6 +9,17 @@
 
 #include "../protocol/packet.h"
 #include "player.h"
+#include "../world/world.h"
+#include "../world/chunk_loader.h"
+#include "tick.h"
+#include "console.h"
+#include "partition.h"
+#include "scheduler.h"
+#include "work_queue.h"
+#include "metrics.h"
+#include "flight_recorder.h"
+#include "watchdog.h"
+#include "../util/thread_pool.h"
 #include <thread>
 #include <atomic>
 #include <mutex>
@@ -24,6 +35,26 @@ typedef struct
     uint64_t spawn_x;
     uint64_t spawn_y;
     uint64_t spawn_z;
+    bool movement_checks;
+    double max_move_per_tick;
+    uint8_t view_distance;
+    view_shape_t view_shape;
+    uint32_t player_chunks_per_tick;
+    uint32_t player_chunk_bytes_per_tick;
+    uint32_t chunks_per_tick;
+    uint32_t chunk_bytes_per_tick;
+    std::string world_directory;
+    uint32_t loader_threads;
+    uint32_t chunk_loads_per_tick;
+    uint32_t region_cache_size;
+    outbound_config_t outbound;
+    uint32_t bulk_backlog;
+    uint32_t tps;
+    uint32_t max_catch_up_ticks;
+    uint32_t worker_threads;
+    double work_budget_ms;
+    uint16_t metrics_port;
+    uint32_t sample_hz;
 }
 server_config_t;
 
@@ -35,9 +66,26 @@ public:
 	std::map<socket_t, c_player> players;
 	std::vector<std::string> chat_messages;
 	std::vector<entity_entry_t> entities;
+	c_world world;
+    c_chunk_loader chunk_loader;
 	std::thread update_thread;
-    std::mutex send_mutex;
+    std::mutex players_mutex;
     std::string server_status;
+    size_t chunk_cursor = 0;
+    std::atomic<uint64_t> current_tick{ 0 };
+    c_tick_scheduler tick_scheduler;
+    c_tick_stats tick_stats;
+    c_console console;
+    c_thread_pool workers;
+    c_task_scheduler tasks;                 // tick thread only
+    c_work_queue jobs;
+    c_metrics_endpoint metrics_endpoint;
+    c_flight_recorder flight_recorder;
+    c_watchdog watchdog;
+    flight_tick_t flight = {};              // tick thread, filled in as the tick runs
+    uint64_t flight_packets[metrics_directions] = {};
+    uint64_t flight_bytes[metrics_directions] = {};
+    std::vector<tick_region_t> regions;
 
 	c_server(const char* config_name);
 
@@ -65,7 +113,15 @@ public:
 	int run();
 	void loop();
 	void update();
+	void tick_region(tick_region_t& region);
+	void update_chunk_loading();
+	void unload_chunks();
+	void schedule_tasks();
+	void render_metrics(std::string& out);
+	void register_routes();
+	void record_flight();
 	void broadcast(std::string& message);
+	void register_commands();
 };
 
 #endif
\ No newline at end of file
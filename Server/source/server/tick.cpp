@@ -0,0 +1,157 @@
+#include "tick.h"
+
+#include <thread>
+#include <algorithm>
+
+c_tick_scheduler::c_tick_scheduler()
+{
+    this->configure(20, 20);
+    this->start();
+}
+
+void c_tick_scheduler::configure(uint32_t tps, uint32_t max_catch_up)
+{
+    if (tps == 0)
+        tps = 1;
+    this->interval = std::chrono::duration_cast<tick_clock_t::duration>(std::chrono::seconds(1)) / tps;
+    this->max_catch_up = max_catch_up;
+}
+
+void c_tick_scheduler::start()
+{
+    this->next = tick_clock_t::now() + this->interval;
+}
+
+uint32_t c_tick_scheduler::wait()
+{
+    tick_clock_t::time_point now = tick_clock_t::now();
+
+    if (now < this->next)
+    {
+        std::this_thread::sleep_until(this->next);
+        this->next += this->interval;
+        return 0;
+    }
+
+    // Behind schedule: run right away, but don't try to make up for a stall
+    // of seconds by running hundreds of ticks in a burst
+    uint64_t behind = static_cast<uint64_t>((now - this->next) / this->interval);
+    if (behind > this->max_catch_up)
+    {
+        this->next = now + this->interval;
+        return static_cast<uint32_t>(behind);
+    }
+
+    this->next += this->interval;
+    return 0;
+}
+
+c_tick_stats::c_tick_stats()
+    : head(0), count(0), total_ticks(0), skipped_ticks(0), overruns(0), target_mspt(50.0)
+{
+    this->configure(20);
+}
+
+void c_tick_stats::configure(uint32_t tps)
+{
+    if (tps == 0)
+        tps = 1;
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->durations.assign(static_cast<size_t>(tps) * 60, 0.f);
+    this->starts.assign(static_cast<size_t>(tps) * 60, tick_clock_t::time_point());
+    this->head = 0;
+    this->count = 0;
+    this->target_mspt = 1000.0 / tps;
+}
+
+void c_tick_stats::record(tick_clock_t::time_point start, tick_clock_t::duration duration)
+{
+    float ms = std::chrono::duration<float, std::milli>(duration).count();
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->durations[this->head] = ms;
+    this->starts[this->head] = start;
+    this->head = (this->head + 1) % this->durations.size();
+    if (this->count < this->durations.size())
+        this->count++;
+
+    this->total_ticks++;
+    if (ms > this->target_mspt)
+        this->overruns++;
+}
+
+void c_tick_stats::record_skipped(uint32_t ticks)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->skipped_ticks += ticks;
+}
+
+static double percentile(std::vector<float>& sorted, double p)
+{
+    size_t index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+tick_report_t c_tick_stats::report(size_t window) const
+{
+    tick_report_t report = {};
+    std::vector<float> samples;
+    tick_clock_t::time_point first, last;
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        size_t n = std::min(window, this->count);
+        if (n == 0)
+            return report;
+
+        size_t capacity = this->durations.size();
+        size_t begin = (this->head + capacity - n) % capacity;
+        samples.reserve(n);
+        for (size_t i = 0; i < n; i++)
+            samples.push_back(this->durations[(begin + i) % capacity]);
+
+        first = this->starts[begin];
+        last = this->starts[(this->head + capacity - 1) % capacity];
+    }
+
+    report.samples = samples.size();
+
+    double sum = 0.0;
+    for (float x : samples)
+        sum += x;
+    report.mspt_mean = sum / samples.size();
+
+    std::sort(samples.begin(), samples.end());
+    report.mspt_p50 = percentile(samples, 0.50);
+    report.mspt_p95 = percentile(samples, 0.95);
+    report.mspt_p99 = percentile(samples, 0.99);
+    report.mspt_max = samples.back();
+
+    // Ticks per second from the start times, so skipped ticks show up
+    double span = std::chrono::duration<double>(last - first).count();
+    double target_tps = 1000.0 / this->target_mspt;
+    report.tps = span > 0.0 ? (report.samples - 1) / span : target_tps;
+    if (report.tps > target_tps)
+        report.tps = target_tps;
+
+    return report;
+}
+
+uint64_t c_tick_stats::get_total_ticks() const
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->total_ticks;
+}
+
+uint64_t c_tick_stats::get_skipped_ticks() const
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->skipped_ticks;
+}
+
+uint64_t c_tick_stats::get_overruns() const
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->overruns;
+}
@@ -0,0 +1,74 @@
+#ifndef IMPL_TICK_H
+#define IMPL_TICK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+typedef std::chrono::steady_clock tick_clock_t;
+
+// Fixed timestep on the monotonic clock. Ticks that were missed are caught
+// up back to back, unless we fell more than max_catch_up ticks behind, in
+// which case they are skipped and the schedule restarts from now.
+class c_tick_scheduler
+{
+private:
+	tick_clock_t::duration interval;
+	tick_clock_t::time_point next;
+	uint32_t max_catch_up;
+public:
+	c_tick_scheduler();
+
+	void configure(uint32_t tps, uint32_t max_catch_up);
+	void start();
+
+	// Sleeps until the next tick is due, returns the number of ticks skipped
+	uint32_t wait();
+
+	tick_clock_t::duration get_interval() const { return this->interval; }
+};
+
+typedef struct
+{
+	double tps;
+	double mspt_mean;
+	double mspt_p50;
+	double mspt_p95;
+	double mspt_p99;
+	double mspt_max;
+	size_t samples;
+}
+tick_report_t;
+
+// Durations and start times of the ticks of the last minute
+class c_tick_stats
+{
+private:
+	mutable std::mutex mutex;
+	std::vector<float> durations;			// milliseconds
+	std::vector<tick_clock_t::time_point> starts;
+	size_t head;
+	size_t count;
+	uint64_t total_ticks;
+	uint64_t skipped_ticks;
+	uint64_t overruns;
+	double target_mspt;
+public:
+	c_tick_stats();
+
+	// Sets the target rate and keeps a minute of ticks at it; clears the ring
+	void configure(uint32_t tps);
+	void record(tick_clock_t::time_point start, tick_clock_t::duration duration);
+	void record_skipped(uint32_t ticks);
+
+	// Statistics over the last window ticks
+	tick_report_t report(size_t window) const;
+
+	uint64_t get_total_ticks() const;
+	uint64_t get_skipped_ticks() const;
+	uint64_t get_overruns() const;
+};
+
+#endif
@@ -0,0 +1,172 @@
+#include "view.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+
+c_view_tracker::c_view_tracker()
+    : radius(0), size(1), shape(view_square), center{ 0, 0 }, active(false)
+{
+    this->configure(0, view_square);
+}
+
+void c_view_tracker::configure(int32_t radius, view_shape_t shape)
+{
+    this->radius = radius < 0 ? 0 : radius;
+    this->size = this->radius * 2 + 1;
+    this->shape = shape;
+    this->active = false;
+    this->pending.clear();
+
+    size_t cells = static_cast<size_t>(this->size) * this->size;
+    this->bits.assign((cells + 63) / 64, 0);
+
+    this->half_width.resize(this->size);
+    for (int32_t dz = -this->radius; dz <= this->radius; dz++)
+    {
+        int32_t width = this->radius;
+        if (shape == view_circle)
+            width = static_cast<int32_t>(std::sqrt(static_cast<double>(this->radius * this->radius - dz * dz)));
+        this->half_width[dz + this->radius] = width;
+    }
+}
+
+size_t c_view_tracker::bit_index(int32_t x, int32_t z) const
+{
+    int32_t mx = ((x % this->size) + this->size) % this->size;
+    int32_t mz = ((z % this->size) + this->size) % this->size;
+    return static_cast<size_t>(mz) * this->size + mx;
+}
+
+void c_view_tracker::set_bit(int32_t x, int32_t z, bool value)
+{
+    size_t index = this->bit_index(x, z);
+    uint64_t mask = 1ull << (index & 63);
+    if (value)
+        this->bits[index >> 6] |= mask;
+    else
+        this->bits[index >> 6] &= ~mask;
+}
+
+bool c_view_tracker::get_bit(int32_t x, int32_t z) const
+{
+    size_t index = this->bit_index(x, z);
+    return (this->bits[index >> 6] >> (index & 63)) & 1;
+}
+
+int32_t c_view_tracker::row_width(int32_t dz) const
+{
+    if (dz < -this->radius || dz > this->radius)
+        return -1;
+    return this->half_width[dz + this->radius];
+}
+
+void c_view_tracker::emit(int32_t x, int32_t z, bool load)
+{
+    this->set_bit(x, z, load);
+
+    chunk_pos_t pos = { x, z };
+    uint64_t key = chunk_key(pos);
+
+    auto it = this->pending.find(key);
+    if (it != this->pending.end() && it->second.load != load)
+    {
+        this->pending.erase(it);
+        return;
+    }
+
+    this->pending[key] = { pos, load };
+}
+
+void c_view_tracker::emit_span(int32_t z, int32_t from, int32_t to, bool load)
+{
+    for (int32_t x = from; x <= to; x++)
+        this->emit(x, z, load);
+}
+
+void c_view_tracker::emit_window(chunk_pos_t at, bool load)
+{
+    for (int32_t dz = -this->radius; dz <= this->radius; dz++)
+    {
+        int32_t width = this->row_width(dz);
+        this->emit_span(at.z + dz, at.x - width, at.x + width, load);
+    }
+}
+
+void c_view_tracker::move_to(chunk_pos_t chunk)
+{
+    if (!this->active)
+    {
+        this->center = chunk;
+        this->active = true;
+        this->emit_window(chunk, true);
+        return;
+    }
+
+    chunk_pos_t from = this->center;
+    if (from.x == chunk.x && from.z == chunk.z)
+        return;
+
+    // Windows that do not overlap share no work, swap them wholesale
+    if (std::abs(chunk.x - from.x) > this->radius * 2 || std::abs(chunk.z - from.z) > this->radius * 2)
+    {
+        this->emit_window(from, false);
+        this->center = chunk;
+        this->emit_window(chunk, true);
+        return;
+    }
+
+    int32_t first_row = std::min(from.z, chunk.z) - this->radius;
+    int32_t last_row = std::max(from.z, chunk.z) + this->radius;
+
+    // Every row of the union is one span in the old and one in the new
+    // window, so only its ends change. Unloads go first: a leaving and an
+    // entering chunk may share a slot of the ring.
+    for (int pass = 0; pass < 2; pass++)
+    {
+        bool load = pass == 1;
+        chunk_pos_t a = load ? chunk : from; // window the chunks are in
+        chunk_pos_t b = load ? from : chunk; // window they are not in
+
+        for (int32_t z = first_row; z <= last_row; z++)
+        {
+            int32_t a_width = this->row_width(z - a.z);
+            if (a_width < 0)
+                continue;
+
+            int32_t a_lo = a.x - a_width, a_hi = a.x + a_width;
+            int32_t b_width = this->row_width(z - b.z);
+            if (b_width < 0)
+            {
+                this->emit_span(z, a_lo, a_hi, load);
+                continue;
+            }
+
+            int32_t b_lo = b.x - b_width, b_hi = b.x + b_width;
+            this->emit_span(z, a_lo, std::min(a_hi, b_lo - 1), load);
+            this->emit_span(z, std::max(a_lo, b_hi + 1), a_hi, load);
+        }
+    }
+
+    this->center = chunk;
+}
+
+bool c_view_tracker::contains(chunk_pos_t chunk) const
+{
+    if (!this->active)
+        return false;
+
+    int32_t width = this->row_width(chunk.z - this->center.z);
+    if (width < 0 || std::abs(chunk.x - this->center.x) > width)
+        return false;
+
+    return this->get_bit(chunk.x, chunk.z);
+}
+
+void c_view_tracker::take_changes(std::vector<view_change_t>& out)
+{
+    out.reserve(out.size() + this->pending.size());
+    for (auto& x : this->pending)
+        out.push_back(x.second);
+    this->pending.clear();
+}
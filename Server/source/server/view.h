@@ -0,0 +1,63 @@
+#ifndef IMPL_VIEW_H
+#define IMPL_VIEW_H
+
+#include <stdint.h>
+#include <vector>
+#include <unordered_map>
+
+#include "../world/world.h"
+
+typedef enum
+{
+	view_square = 0,
+	view_circle
+}
+view_shape_t;
+
+typedef struct
+{
+	chunk_pos_t pos;
+	bool load;
+}
+view_change_t;
+
+// Set of chunks a player can see, centred on the chunk the player is in.
+// Membership is a bitset ring indexed by chunk coordinates modulo the window
+// size, so no two chunks of one window share a bit. Moving the centre only
+// walks the edge of each row and emits the chunks that entered or left.
+class c_view_tracker
+{
+private:
+	int32_t radius;
+	int32_t size;
+	view_shape_t shape;
+	std::vector<uint64_t> bits;
+	std::vector<int32_t> half_width; // per row offset from the centre
+	chunk_pos_t center;
+	bool active;
+
+	// Changes not yet taken; a load and an unload of one chunk cancel out
+	std::unordered_map<uint64_t, view_change_t> pending;
+
+	size_t bit_index(int32_t x, int32_t z) const;
+	void set_bit(int32_t x, int32_t z, bool value);
+	bool get_bit(int32_t x, int32_t z) const;
+	int32_t row_width(int32_t dz) const;
+	void emit(int32_t x, int32_t z, bool load);
+	void emit_span(int32_t z, int32_t from, int32_t to, bool load);
+	void emit_window(chunk_pos_t at, bool load);
+public:
+	c_view_tracker();
+
+	void configure(int32_t radius, view_shape_t shape);
+	void move_to(chunk_pos_t chunk);
+
+	bool contains(chunk_pos_t chunk) const;
+	bool is_active() const { return this->active; }
+	chunk_pos_t get_center() const { return this->center; }
+	int32_t get_radius() const { return this->radius; }
+
+	void take_changes(std::vector<view_change_t>& out);
+};
+
+#endif
@@ -0,0 +1,256 @@
+#include "watchdog.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+#include "../util/symbols.h"
+
+#ifdef WATCHDOG_STACKS
+#include <signal.h>
+#include <execinfo.h>
+
+// Frames of the signal handler and the kernel's return trampoline
+#define WATCHDOG_SKIP_FRAMES 2
+
+#define WATCHDOG_SIGNAL SIGUSR2
+
+// One sample is taken at a time, so a single slot is enough. The handler
+// only touches it while the state says a sample was asked for.
+static std::atomic<int> sample_state(0);	// 0 idle, 1 requested, 3 capturing, 2 captured
+static void* sample_frames[WATCHDOG_MAX_FRAMES + WATCHDOG_SKIP_FRAMES];
+static int sample_depth = 0;
+
+static void on_sample_signal(int)
+{
+    int expected = 1;
+    if (!sample_state.compare_exchange_strong(expected, 3))
+        return;
+
+    sample_depth = backtrace(sample_frames, WATCHDOG_MAX_FRAMES + WATCHDOG_SKIP_FRAMES);
+    sample_state.store(2, std::memory_order_release);
+}
+#endif
+
+static int64_t steady_millis()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+        ).count();
+}
+
+c_watchdog::c_watchdog()
+    : last_beat(0), last_tick(0), timeout_ms(0), running(false)
+{
+}
+
+c_watchdog::~c_watchdog()
+{
+    this->stop();
+}
+
+void c_watchdog::configure(uint32_t timeout_seconds)
+{
+    this->timeout_ms = timeout_seconds * 1000;
+}
+
+void c_watchdog::watch_current_thread(const char* name)
+{
+    watched_thread_t watched;
+    watched.name = name;
+#ifdef WATCHDOG_STACKS
+    watched.handle = pthread_self();
+#endif
+    watched.samples = 0;
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->threads.push_back(watched);
+}
+
+void c_watchdog::beat(uint64_t tick)
+{
+    this->last_tick.store(tick, std::memory_order_relaxed);
+    this->last_beat.store(steady_millis(), std::memory_order_relaxed);
+}
+
+void c_watchdog::start()
+{
+    if (!this->timeout_ms || this->running)
+        return;
+
+#ifdef WATCHDOG_STACKS
+    // The first backtrace() loads libgcc, which must not happen inside the handler
+    void* warm_up[1];
+    backtrace(warm_up, 1);
+
+    struct sigaction action = {};
+    action.sa_handler = on_sample_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(WATCHDOG_SIGNAL, &action, nullptr);
+#endif
+
+    this->last_beat = steady_millis();
+    this->running = true;
+    this->thread = std::thread(&c_watchdog::loop, this);
+}
+
+void c_watchdog::stop()
+{
+    this->running = false;
+    if (this->thread.joinable())
+        this->thread.join();
+}
+
+void c_watchdog::sample(watched_thread_t& watched)
+{
+#ifdef WATCHDOG_STACKS
+    sample_state.store(1);
+    if (pthread_kill(watched.handle, WATCHDOG_SIGNAL) != 0)
+    {
+        sample_state.store(0);
+        return;
+    }
+
+    int64_t give_up = steady_millis() + 100;
+    while (sample_state.load(std::memory_order_acquire) != 2)
+    {
+        // Only a request the handler hasn't picked up can be called off, one
+        // that is already capturing fills the slot and is waited for
+        int expected = 1;
+        if (steady_millis() > give_up && sample_state.compare_exchange_strong(expected, 0))
+            return;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    std::vector<void*> stack;
+    for (int i = WATCHDOG_SKIP_FRAMES; i < sample_depth; i++)
+        stack.push_back(sample_frames[i]);
+    sample_state.store(0);
+
+    watched.samples++;
+    watched.stacks[stack]++;
+
+    // Count each frame once per sample, recursion would inflate it otherwise
+    std::sort(stack.begin(), stack.end());
+    stack.erase(std::unique(stack.begin(), stack.end()), stack.end());
+    for (void* frame : stack)
+        watched.frames[frame]++;
+#else
+    (void)watched;
+#endif
+}
+
+void c_watchdog::report(double stalled_seconds, bool final)
+{
+    if (final)
+        printf("Watchdog: tick thread recovered after %.1f s\r\n", stalled_seconds);
+    else
+        printf("Watchdog: tick thread stalled for %.1f s, last tick %llu\r\n",
+            stalled_seconds, (unsigned long long)this->last_tick.load());
+
+#ifdef WATCHDOG_STACKS
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (watched_thread_t& watched : this->threads)
+    {
+        if (!watched.samples)
+            continue;
+
+        printf("  %s thread, %u samples, hottest frames:\r\n", watched.name, watched.samples);
+
+        // Addresses inside the same function are one frame as far as the
+        // reader is concerned
+        std::map<std::string, uint32_t> functions;
+        for (auto& x : watched.frames)
+        {
+            uint32_t& count = functions[symbol_name(x.first, false)];
+            count = std::min(count + x.second, watched.samples);
+        }
+
+        std::vector<std::pair<uint32_t, std::string>> hottest;
+        for (auto& x : functions)
+            hottest.push_back({ x.second, x.first });
+        std::sort(hottest.begin(), hottest.end(), [](const std::pair<uint32_t, std::string>& a, const std::pair<uint32_t, std::string>& b)
+        {
+            return a.first > b.first;
+        });
+
+        for (size_t i = 0; i < hottest.size() && i < 12; i++)
+        {
+            printf("    %5.1f%%  %s\r\n", 100.0 * hottest[i].first / watched.samples, hottest[i].second.c_str());
+        }
+
+        auto common = std::max_element(watched.stacks.begin(), watched.stacks.end(),
+            [](const std::pair<const std::vector<void*>, uint32_t>& a, const std::pair<const std::vector<void*>, uint32_t>& b)
+        {
+            return a.second < b.second;
+        });
+        if (common != watched.stacks.end())
+        {
+            printf("    most common stack (%u samples):\r\n", common->second);
+            for (void* frame : common->first)
+                printf("      %s\r\n", symbol_name(frame, true).c_str());
+        }
+    }
+#else
+    printf("  stack sampling is not available on this platform\r\n");
+#endif
+}
+
+void c_watchdog::loop()
+{
+    bool stalled = false;
+    int64_t stall_start = 0;
+    int64_t next_report = 0;
+
+    while (this->running)
+    {
+        int64_t now = steady_millis();
+        int64_t beat = this->last_beat.load(std::memory_order_relaxed);
+
+        if (now - beat < this->timeout_ms)
+        {
+            if (stalled)
+            {
+                this->report((now - stall_start) / 1000.0, true);
+                stalled = false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(250));
+            continue;
+        }
+
+        if (!stalled)
+        {
+            stalled = true;
+            stall_start = beat;
+
+            std::lock_guard<std::mutex> lock(this->mutex);
+            for (watched_thread_t& watched : this->threads)
+            {
+                watched.samples = 0;
+                watched.frames.clear();
+                watched.stacks.clear();
+            }
+
+            // A second of samples makes the first report worth reading
+            next_report = now + 1000;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            for (watched_thread_t& watched : this->threads)
+                this->sample(watched);
+        }
+
+        if (now >= next_report)
+        {
+            this->report((now - stall_start) / 1000.0, false);
+            next_report = now + WATCHDOG_REPORT_SECONDS * 1000;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(WATCHDOG_SAMPLE_MS));
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef IMPL_WATCHDOG_H
+#define IMPL_WATCHDOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <pthread.h>
+#define WATCHDOG_STACKS
+#endif
+
+#define WATCHDOG_MAX_FRAMES		48
+#define WATCHDOG_SAMPLE_MS		50		// between stack samples while stalled
+#define WATCHDOG_REPORT_SECONDS	10		// between reports of the same stall
+
+// Notices when the tick thread stops calling beat(). While the stall lasts
+// the watched threads are interrupted with a signal and their stacks are
+// recorded; the frames seen most often are logged, which is usually enough
+// to tell a deadlock from a loop that never ends. Without signal based
+// stack capture (Windows) only the stall itself is reported.
+class c_watchdog
+{
+private:
+	typedef struct
+	{
+		const char* name;
+#ifdef WATCHDOG_STACKS
+		pthread_t handle;
+#endif
+		uint32_t samples;
+		std::map<void*, uint32_t> frames;				// samples a frame was on the stack
+		std::map<std::vector<void*>, uint32_t> stacks;	// identical stacks
+	}
+	watched_thread_t;
+
+	std::mutex mutex;
+	std::vector<watched_thread_t> threads;
+	std::atomic<int64_t> last_beat;			// milliseconds on the steady clock
+	std::atomic<uint64_t> last_tick;
+	uint32_t timeout_ms;
+
+	std::atomic<bool> running;
+	std::thread thread;
+
+	void loop();
+	void sample(watched_thread_t& watched);
+	void report(double stalled_seconds, bool final);
+public:
+	c_watchdog();
+	~c_watchdog();
+	c_watchdog(const c_watchdog&) = delete;
+	c_watchdog& operator=(const c_watchdog&) = delete;
+
+	// 0 turns the watchdog off
+	void configure(uint32_t timeout_seconds);
+
+	// Adds the calling thread to the threads sampled during a stall
+	void watch_current_thread(const char* name);
+
+	// Tick thread, once per tick
+	void beat(uint64_t tick);
+
+	void start();
+	void stop();
+};
+
+#endif
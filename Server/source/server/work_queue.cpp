@@ -0,0 +1,118 @@
+#include "work_queue.h"
+
+#include <stdio.h>
+
+c_work_queue::c_work_queue()
+    : next_id(1), completed(0), passes(0)
+{
+}
+
+uint64_t c_work_queue::submit(std::unique_ptr<c_job> job)
+{
+    std::shared_ptr<queued_job_t> entry = std::make_shared<queued_job_t>();
+    entry->status = {};
+    entry->status.name = job->get_name();
+    entry->job = std::move(job);
+    entry->cancelled = false;
+    entry->last_pass = 0;
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    entry->status.id = this->next_id++;
+    this->jobs.push_back(entry);
+    return entry->status.id;
+}
+
+bool c_work_queue::cancel(uint64_t id)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (std::shared_ptr<queued_job_t>& entry : this->jobs)
+    {
+        if (entry->status.id == id && !entry->cancelled)
+        {
+            entry->cancelled = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+void c_work_queue::run(tick_clock_t::time_point deadline)
+{
+    uint64_t pass;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        pass = ++this->passes;
+    }
+
+    while (tick_clock_t::now() < deadline)
+    {
+        // Only the deque itself is locked, steps run without holding it so
+        // submit() and get_status() never wait for a job
+        std::shared_ptr<queued_job_t> entry;
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            if (this->jobs.empty())
+                break;
+
+            entry = this->jobs.front();
+            this->jobs.pop_front();
+
+            if (entry->cancelled)
+            {
+                printf("Job %llu (%s) cancelled at %.0f%%\r\n",
+                    (unsigned long long)entry->status.id, entry->status.name.c_str(), entry->status.progress * 100.f);
+                continue;
+            }
+        }
+
+        tick_clock_t::time_point start = tick_clock_t::now();
+        bool more = entry->job->step();
+        double ms = std::chrono::duration<double, std::milli>(tick_clock_t::now() - start).count();
+
+        std::lock_guard<std::mutex> lock(this->mutex);
+        job_status_t& status = entry->status;
+        status.steps++;
+        status.time_ms += ms;
+        if (ms > status.slowest_step_ms)
+            status.slowest_step_ms = ms;
+        status.progress = more ? entry->job->get_progress() : 1.f;
+
+        if (entry->last_pass != pass)
+        {
+            entry->last_pass = pass;
+            status.ticks++;
+        }
+
+        if (more)
+        {
+            this->jobs.push_back(entry);
+        }
+        else
+        {
+            this->completed++;
+            printf("Job %llu (%s) finished: %llu steps over %u ticks, %.2f ms\r\n",
+                (unsigned long long)status.id, status.name.c_str(), (unsigned long long)status.steps,
+                status.ticks, status.time_ms);
+        }
+    }
+}
+
+void c_work_queue::get_status(std::vector<job_status_t>& out)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    out.clear();
+    for (std::shared_ptr<queued_job_t>& entry : this->jobs)
+        out.push_back(entry->status);
+}
+
+size_t c_work_queue::size()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->jobs.size();
+}
+
+uint64_t c_work_queue::get_completed()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->completed;
+}
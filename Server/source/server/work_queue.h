@@ -0,0 +1,77 @@
+#ifndef IMPL_WORK_QUEUE_H
+#define IMPL_WORK_QUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "tick.h"
+
+// A long running job split into small steps. step() should do roughly a
+// tenth of a millisecond of work and return false once there is nothing
+// left; the queue calls it again on later ticks until then.
+class c_job
+{
+public:
+	virtual ~c_job() = default;
+
+	virtual bool step() = 0;
+	virtual const char* get_name() const = 0;
+
+	// 0 to 1, for reporting only
+	virtual float get_progress() const { return 0.f; }
+};
+
+typedef struct
+{
+	uint64_t id;
+	std::string name;
+	float progress;
+	uint64_t steps;
+	uint32_t ticks;				// ticks the job ran in
+	double time_ms;				// total time spent in step()
+	double slowest_step_ms;
+}
+job_status_t;
+
+// Runs queued jobs on the tick thread for at most a given amount of time
+// per tick, round robin so one big job doesn't hold back the others.
+// Jobs may be submitted and cancelled from any thread.
+class c_work_queue
+{
+private:
+	typedef struct
+	{
+		std::unique_ptr<c_job> job;
+		job_status_t status;
+		uint64_t last_pass;		// run() call that last stepped it
+		bool cancelled;
+	}
+	queued_job_t;
+
+	std::mutex mutex;
+	std::deque<std::shared_ptr<queued_job_t>> jobs;
+	uint64_t next_id;
+	uint64_t completed;
+	uint64_t passes;
+public:
+	c_work_queue();
+	c_work_queue(const c_work_queue&) = delete;
+	c_work_queue& operator=(const c_work_queue&) = delete;
+
+	uint64_t submit(std::unique_ptr<c_job> job);
+	bool cancel(uint64_t id);
+
+	// Steps jobs until the deadline passes or no job is left
+	void run(tick_clock_t::time_point deadline);
+
+	void get_status(std::vector<job_status_t>& out);
+	size_t size();
+	uint64_t get_completed();
+};
+
+#endif
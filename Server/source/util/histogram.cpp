@@ -0,0 +1,134 @@
+#include "histogram.h"
+
+#include <string.h>
+#include <chrono>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#define SUB_COUNT (1u << HISTOGRAM_SUB_BITS)
+
+static inline int highest_bit(uint64_t value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return 63 - __builtin_clzll(value);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    unsigned long bit;
+    _BitScanReverse64(&bit, value);
+    return static_cast<int>(bit);
+#else
+    int bit = 0;
+    while (value >>= 1)
+        bit++;
+    return bit;
+#endif
+}
+
+c_histogram::c_histogram()
+{
+    this->reset();
+}
+
+size_t c_histogram::bucket_of(uint64_t value)
+{
+    // Below 2 * SUB_COUNT every value has its own bucket
+    if (value < 2 * SUB_COUNT)
+        return static_cast<size_t>(value);
+
+    int shift = highest_bit(value) - HISTOGRAM_SUB_BITS;
+    if (shift > HISTOGRAM_MAX_SHIFT)
+        return HISTOGRAM_BUCKETS - 1;
+
+    return (static_cast<size_t>(shift) << HISTOGRAM_SUB_BITS) + static_cast<size_t>(value >> shift);
+}
+
+uint64_t c_histogram::bucket_low(size_t bucket)
+{
+    if (bucket < 2 * SUB_COUNT)
+        return bucket;
+
+    size_t shift = (bucket >> HISTOGRAM_SUB_BITS) - 1;
+    return static_cast<uint64_t>(bucket - (shift << HISTOGRAM_SUB_BITS)) << shift;
+}
+
+uint64_t c_histogram::bucket_high(size_t bucket)
+{
+    if (bucket < 2 * SUB_COUNT)
+        return bucket;
+
+    size_t shift = (bucket >> HISTOGRAM_SUB_BITS) - 1;
+    return bucket_low(bucket) + (1ull << shift) - 1;
+}
+
+void c_histogram::record(uint64_t value)
+{
+    this->counts[bucket_of(value)]++;
+    this->total++;
+    this->sum += value;
+    if (value > this->max)
+        this->max = value;
+}
+
+void c_histogram::add(size_t bucket, uint64_t count)
+{
+    if (!count || bucket >= HISTOGRAM_BUCKETS)
+        return;
+
+    this->counts[bucket] += count;
+    this->total += count;
+
+    // Exact values are gone, the middle of the bucket is close enough
+    uint64_t low = bucket_low(bucket);
+    uint64_t high = bucket_high(bucket);
+    this->sum += count * (low + (high - low) / 2);
+    if (high > this->max)
+        this->max = high;
+}
+
+void c_histogram::merge(const c_histogram& other)
+{
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+        this->counts[i] += other.counts[i];
+    this->total += other.total;
+    this->sum += other.sum;
+    if (other.max > this->max)
+        this->max = other.max;
+}
+
+void c_histogram::reset()
+{
+    memset(this->counts, 0, sizeof(this->counts));
+    this->total = 0;
+    this->sum = 0;
+    this->max = 0;
+}
+
+uint64_t c_histogram::percentile(double quantile) const
+{
+    if (!this->total)
+        return 0;
+
+    uint64_t rank = static_cast<uint64_t>(quantile * this->total + 0.5);
+    if (rank < 1)
+        rank = 1;
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        seen += this->counts[i];
+        if (seen >= rank)
+        {
+            uint64_t high = bucket_high(i);
+            return high < this->max ? high : this->max;
+        }
+    }
+    return this->max;
+}
+
+uint64_t monotonic_micros()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+        ).count();
+}
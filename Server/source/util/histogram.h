@@ -0,0 +1,47 @@
+#ifndef UTIL_HISTOGRAM_H
+#define UTIL_HISTOGRAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// 32 linear sub-buckets per power of two keep every bucket within about
+// 3% of its value; shifts up to 26 cover a bit over half an hour in
+// microseconds.
+#define HISTOGRAM_SUB_BITS	5
+#define HISTOGRAM_MAX_SHIFT	26
+#define HISTOGRAM_BUCKETS	((HISTOGRAM_MAX_SHIFT + 2) << HISTOGRAM_SUB_BITS)
+
+// Log-linear histogram in the style of HdrHistogram. Bucket math is
+// static so hot paths can keep their own counters and only build a
+// histogram when percentiles are asked for.
+class c_histogram
+{
+private:
+	uint64_t counts[HISTOGRAM_BUCKETS];
+	uint64_t total;
+	uint64_t sum;
+	uint64_t max;
+public:
+	c_histogram();
+
+	static size_t bucket_of(uint64_t value);
+	static uint64_t bucket_low(size_t bucket);
+	static uint64_t bucket_high(size_t bucket);
+
+	void record(uint64_t value);
+	void add(size_t bucket, uint64_t count);
+	void merge(const c_histogram& other);
+	void reset();
+
+	// Upper bound of the bucket holding the given quantile, 0 when empty
+	uint64_t percentile(double quantile) const;
+
+	uint64_t get_count() const { return this->total; }
+	uint64_t get_max() const { return this->max; }
+	double get_mean() const { return this->total ? static_cast<double>(this->sum) / this->total : 0.0; }
+};
+
+// Microseconds on the steady clock
+uint64_t monotonic_micros();
+
+#endif
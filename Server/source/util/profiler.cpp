@@ -0,0 +1,135 @@
+#include "profiler.h"
+
+#include <stdio.h>
+#include <chrono>
+
+static thread_local void* current_buffer = nullptr;
+
+c_profiler::c_profiler()
+    : enabled(false), session_start(0), session_end(0)
+{
+}
+
+c_profiler& c_profiler::instance()
+{
+    static c_profiler profiler;
+    return profiler;
+}
+
+uint64_t c_profiler::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+        ).count();
+}
+
+c_profiler::thread_buffer_t* c_profiler::get_buffer()
+{
+    if (current_buffer)
+        return static_cast<thread_buffer_t*>(current_buffer);
+
+    std::unique_ptr<thread_buffer_t> buffer = std::make_unique<thread_buffer_t>();
+    buffer->events = std::make_unique<profile_event_t[]>(PROFILER_EVENTS_PER_THREAD);
+    buffer->head = 0;
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    buffer->tid = static_cast<uint32_t>(this->buffers.size() + 1);
+    buffer->name = "thread " + std::to_string(buffer->tid);
+    current_buffer = buffer.get();
+    this->buffers.push_back(std::move(buffer));
+    return static_cast<thread_buffer_t*>(current_buffer);
+}
+
+void c_profiler::start()
+{
+    this->session_start = now();
+    this->session_end = UINT64_MAX;
+    this->enabled = true;
+}
+
+void c_profiler::stop()
+{
+    this->enabled = false;
+    this->session_end = now();
+}
+
+void c_profiler::set_thread_name(const char* name)
+{
+    thread_buffer_t* buffer = this->get_buffer();
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    buffer->name = name;
+}
+
+void c_profiler::record(const char* name, uint64_t start, uint64_t end)
+{
+    thread_buffer_t* buffer = this->get_buffer();
+
+    uint64_t head = buffer->head.load(std::memory_order_relaxed);
+    profile_event_t& event = buffer->events[head & (PROFILER_EVENTS_PER_THREAD - 1)];
+    event.name = name;
+    event.start = start;
+    event.duration = end - start;
+    buffer->head.store(head + 1, std::memory_order_release);
+}
+
+static void write_json_string(FILE* file, const char* text)
+{
+    fputc('"', file);
+    for (const char* c = text; *c; c++)
+    {
+        if (*c == '"' || *c == '\\')
+            fputc('\\', file);
+        if (static_cast<unsigned char>(*c) >= 0x20)
+            fputc(*c, file);
+    }
+    fputc('"', file);
+}
+
+bool c_profiler::dump(const char* path, size_t* events_written)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file)
+        return false;
+
+    uint64_t begin = this->session_start;
+    uint64_t end = this->session_end;
+    size_t written = 0;
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (std::unique_ptr<thread_buffer_t>& buffer : this->buffers)
+    {
+        fprintf(file, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":",
+            written ? "," : "", buffer->tid);
+        write_json_string(file, buffer->name.c_str());
+        fprintf(file, "}}\n");
+        written++;
+
+        uint64_t head = buffer->head.load(std::memory_order_acquire);
+        uint64_t count = head < PROFILER_EVENTS_PER_THREAD ? head : PROFILER_EVENTS_PER_THREAD;
+
+        for (uint64_t i = head - count; i < head; i++)
+        {
+            const profile_event_t& event = buffer->events[i & (PROFILER_EVENTS_PER_THREAD - 1)];
+            if (event.start < begin || event.start > end)
+                continue;
+
+            // Timestamps are microseconds from the start of the session
+            fprintf(file, ",{\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"name\":",
+                buffer->tid, (event.start - begin) / 1000.0, event.duration / 1000.0);
+            write_json_string(file, event.name);
+            fprintf(file, "}\n");
+            written++;
+        }
+    }
+
+    fprintf(file, "]}\n");
+    bool ok = ferror(file) == 0;
+    fclose(file);
+
+    if (events_written)
+        *events_written = written;
+    return ok;
+}
@@ -0,0 +1,92 @@
+#ifndef UTIL_PROFILER_H
+#define UTIL_PROFILER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Events kept per thread, older ones are overwritten
+#define PROFILER_EVENTS_PER_THREAD (1 << 16)
+
+typedef struct
+{
+	const char* name;		// must be a string literal
+	uint64_t start;			// nanoseconds on the steady clock
+	uint64_t duration;
+}
+profile_event_t;
+
+// Scoped timing markers written to a ring per thread. Only the owning
+// thread writes its ring, so recording takes no lock; when profiling is
+// off a marker costs a single relaxed load. dump() writes everything
+// recorded since start() as Chrome trace JSON, which chrome://tracing and
+// ui.perfetto.dev open directly.
+class c_profiler
+{
+private:
+	typedef struct
+	{
+		std::string name;
+		uint32_t tid;
+		std::unique_ptr<profile_event_t[]> events;
+		std::atomic<uint64_t> head;
+	}
+	thread_buffer_t;
+
+	std::atomic<bool> enabled;
+	std::atomic<uint64_t> session_start;
+	std::atomic<uint64_t> session_end;
+
+	std::mutex mutex;		// only guards the list of buffers
+	std::vector<std::unique_ptr<thread_buffer_t>> buffers;
+
+	c_profiler();
+	thread_buffer_t* get_buffer();
+public:
+	static c_profiler& instance();
+
+	static uint64_t now();
+
+	bool is_enabled() const { return this->enabled.load(std::memory_order_relaxed); }
+	void start();
+	void stop();
+
+	void set_thread_name(const char* name);
+	void record(const char* name, uint64_t start, uint64_t end);
+
+	// Writes the last session, false if the file couldn't be written
+	bool dump(const char* path, size_t* events_written = nullptr);
+};
+
+class c_profile_scope
+{
+private:
+	const char* name;
+	uint64_t start;
+public:
+	c_profile_scope(const char* name)
+		: name(c_profiler::instance().is_enabled() ? name : nullptr), start(0)
+	{
+		if (this->name)
+			this->start = c_profiler::now();
+	}
+
+	~c_profile_scope()
+	{
+		if (this->name)
+			c_profiler::instance().record(this->name, this->start, c_profiler::now());
+	}
+
+	c_profile_scope(const c_profile_scope&) = delete;
+	c_profile_scope& operator=(const c_profile_scope&) = delete;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name) c_profile_scope PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+
+#endif
@@ -0,0 +1,302 @@
+#include "sampler.h"
+#include "symbols.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+
+#ifdef SAMPLER_SUPPORTED
+#include <unistd.h>
+#include <execinfo.h>
+#include <sys/syscall.h>
+
+// Older glibc headers only have the union member
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+// Frames of the signal handler and the kernel's return trampoline
+#define SAMPLER_SKIP_FRAMES 2
+#endif
+
+static thread_local sample_buffer_t* current_buffer = nullptr;
+
+// Checked by the handler first, so a signal still pending after stop()
+// leaves the buffers alone
+static std::atomic<bool> sampling(false);
+
+#ifdef SAMPLER_SUPPORTED
+static void on_profile_signal(int)
+{
+    int saved_errno = errno;
+
+    sample_buffer_t* buffer = current_buffer;
+    if (buffer && sampling.load(std::memory_order_acquire))
+    {
+        size_t index = buffer->count.load(std::memory_order_relaxed);
+        if (index < buffer->capacity)
+        {
+            stack_sample_t& sample = buffer->samples[index];
+            sample.depth = backtrace(sample.frames, SAMPLER_MAX_FRAMES);
+            buffer->count.store(index + 1, std::memory_order_release);
+        }
+        else
+        {
+            buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    errno = saved_errno;
+}
+#endif
+
+c_sampler::c_sampler()
+    : running(false), hz(0)
+{
+}
+
+c_sampler& c_sampler::instance()
+{
+    static c_sampler sampler;
+    return sampler;
+}
+
+void c_sampler::register_current_thread(const char* name)
+{
+    std::unique_ptr<sampled_thread_t> thread = std::make_unique<sampled_thread_t>();
+    thread->name = name;
+    thread->armed = false;
+    thread->buffer.samples = nullptr;
+    thread->buffer.capacity = 0;
+    thread->buffer.count = 0;
+    thread->buffer.dropped = 0;
+
+    // Folded stacks use ';' between frames
+    std::replace(thread->name.begin(), thread->name.end(), ';', ',');
+#ifdef SAMPLER_SUPPORTED
+    thread->tid = static_cast<pid_t>(syscall(SYS_gettid));
+    thread->handle = pthread_self();
+#endif
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    current_buffer = &thread->buffer;
+    this->threads.push_back(std::move(thread));
+}
+
+void c_sampler::unregister_current_thread()
+{
+    sample_buffer_t* buffer = current_buffer;
+    if (!buffer)
+        return;
+    current_buffer = nullptr;
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (auto it = this->threads.begin(); it != this->threads.end(); ++it)
+    {
+        if (&(*it)->buffer != buffer)
+            continue;
+
+        this->disarm(**it);
+        this->threads.erase(it);
+        break;
+    }
+}
+
+void c_sampler::disarm(sampled_thread_t& thread)
+{
+#ifdef SAMPLER_SUPPORTED
+    if (thread.armed)
+        timer_delete(thread.timer);
+#endif
+    thread.armed = false;
+}
+
+bool c_sampler::start(uint32_t hz, std::string& error)
+{
+#ifdef SAMPLER_SUPPORTED
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->running)
+    {
+        error = "already sampling";
+        return false;
+    }
+
+    hz = std::max<uint32_t>(1, std::min<uint32_t>(hz, SAMPLER_MAX_HZ));
+
+    // The first backtrace() loads libgcc, which must not happen inside the handler
+    void* warm_up[1];
+    backtrace(warm_up, 1);
+
+    struct sigaction action = {};
+    action.sa_handler = on_profile_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, nullptr) != 0)
+    {
+        error = "couldn't install the SIGPROF handler";
+        return false;
+    }
+
+    // Buffers are kept between sessions and only replaced when a higher
+    // rate needs more room
+    size_t capacity = std::min<size_t>(static_cast<size_t>(hz) * SAMPLER_BUFFER_SECONDS, SAMPLER_MAX_SAMPLES);
+    for (std::unique_ptr<sampled_thread_t>& thread : this->threads)
+    {
+        if (thread->buffer.capacity < capacity)
+        {
+            thread->storage = std::make_unique<stack_sample_t[]>(capacity);
+            thread->buffer.samples = thread->storage.get();
+            thread->buffer.capacity = capacity;
+        }
+        thread->buffer.count = 0;
+        thread->buffer.dropped = 0;
+    }
+
+    sampling.store(true, std::memory_order_release);
+
+    long interval = 1000000000L / hz;
+    struct itimerspec spec = {};
+    spec.it_interval.tv_sec = interval / 1000000000L;
+    spec.it_interval.tv_nsec = interval % 1000000000L;
+    spec.it_value = spec.it_interval;
+
+    size_t armed = 0;
+    for (std::unique_ptr<sampled_thread_t>& thread : this->threads)
+    {
+        clockid_t clock;
+        if (pthread_getcpuclockid(thread->handle, &clock) != 0)
+            continue;
+
+        struct sigevent event = {};
+        event.sigev_notify = SIGEV_THREAD_ID;
+        event.sigev_signo = SIGPROF;
+        event.sigev_notify_thread_id = thread->tid;
+        if (timer_create(clock, &event, &thread->timer) != 0)
+            continue;
+
+        thread->armed = true;
+        if (timer_settime(thread->timer, 0, &spec, nullptr) != 0)
+        {
+            this->disarm(*thread);
+            continue;
+        }
+        armed++;
+    }
+
+    if (!armed)
+    {
+        sampling = false;
+        error = "couldn't create a CPU timer for any thread: " + std::string(strerror(errno));
+        return false;
+    }
+
+    this->hz = hz;
+    this->running = true;
+    return true;
+#else
+    (void)hz;
+    error = "sampling isn't supported on this platform";
+    return false;
+#endif
+}
+
+bool c_sampler::stop(std::string& folded, size_t* samples, size_t* dropped)
+{
+    size_t total = 0;
+    size_t lost = 0;
+
+    // Identical stacks of a thread are counted under the lock, symbols are
+    // looked up after it's released so registering threads and starting
+    // the next session don't wait for that
+    std::map<std::pair<std::string, std::vector<void*>>, uint64_t> raw;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (!this->running)
+            return false;
+
+        for (std::unique_ptr<sampled_thread_t>& thread : this->threads)
+            this->disarm(*thread);
+        sampling = false;
+        this->running = false;
+
+#ifdef SAMPLER_SUPPORTED
+        for (std::unique_ptr<sampled_thread_t>& thread : this->threads)
+        {
+            size_t count = thread->buffer.count.load(std::memory_order_acquire);
+            total += count;
+            lost += thread->buffer.dropped.load();
+
+            for (size_t i = 0; i < count; i++)
+            {
+                const stack_sample_t& sample = thread->buffer.samples[i];
+
+                // Outermost frame first
+                std::vector<void*> frames;
+                for (int frame = sample.depth - 1; frame >= SAMPLER_SKIP_FRAMES; frame--)
+                {
+                    // Only the interrupted frame holds the exact instruction,
+                    // the others hold return addresses that may already point
+                    // past the end of the calling function
+                    void* address = sample.frames[frame];
+                    if (frame != SAMPLER_SKIP_FRAMES)
+                        address = static_cast<char*>(address) - 1;
+                    frames.push_back(address);
+                }
+                raw[{ thread->name, frames }]++;
+            }
+        }
+#endif
+    }
+
+    std::unordered_map<void*, std::string> names;
+    std::map<std::string, uint64_t> stacks;
+    for (auto& x : raw)
+    {
+        // The thread's name as the root
+        std::string stack = x.first.first;
+        for (void* address : x.first.second)
+        {
+            auto name = names.find(address);
+            if (name == names.end())
+            {
+                std::string symbol = symbol_name(address, false);
+                std::replace(symbol.begin(), symbol.end(), ';', ',');
+                name = names.emplace(address, symbol).first;
+            }
+
+            stack += ';';
+            stack += name->second;
+        }
+        stacks[stack] += x.second;
+    }
+
+    folded.clear();
+    for (auto& x : stacks)
+    {
+        folded += x.first;
+        folded += ' ';
+        folded += std::to_string(x.second);
+        folded += '\n';
+    }
+
+    if (samples)
+        *samples = total;
+    if (dropped)
+        *dropped = lost;
+    return true;
+}
+
+bool c_sampler::is_running()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->running;
+}
+
+uint32_t c_sampler::get_hz()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->hz;
+}
@@ -0,0 +1,94 @@
+#ifndef UTIL_SAMPLER_H
+#define UTIL_SAMPLER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#define SAMPLER_SUPPORTED
+#endif
+
+#define SAMPLER_MAX_FRAMES		48
+#define SAMPLER_MAX_HZ			1000
+#define SAMPLER_BUFFER_SECONDS	120		// of samples kept per thread at full CPU
+#define SAMPLER_MAX_SAMPLES		32768	// per thread and session
+
+typedef struct
+{
+	int depth;
+	void* frames[SAMPLER_MAX_FRAMES];
+}
+stack_sample_t;
+
+// What the signal handler of a thread writes to
+typedef struct
+{
+	stack_sample_t* samples;
+	size_t capacity;
+	std::atomic<size_t> count;
+	std::atomic<uint32_t> dropped;
+}
+sample_buffer_t;
+
+// Statistical CPU profiler for the threads that registered themselves.
+// Each one gets a timer on its own CPU clock that raises SIGPROF after
+// every 1/hz seconds of CPU time it used, so a thread waiting in select
+// or on a mutex isn't sampled at all. CPU timers run off the scheduler
+// tick, so rates above CONFIG_HZ (often 250) give no more samples.
+//
+// The handler only stores the return addresses into a buffer owned by its
+// thread; symbols are looked up once per distinct address when the
+// session stops, and the result comes back in the folded format
+// flamegraph.pl, speedscope and inferno read:
+// "thread;outermost;...;innermost count" per line.
+class c_sampler
+{
+private:
+	typedef struct
+	{
+		std::string name;
+#ifdef SAMPLER_SUPPORTED
+		pid_t tid;
+		pthread_t handle;
+		timer_t timer;
+#endif
+		bool armed;
+		std::unique_ptr<stack_sample_t[]> storage;
+		sample_buffer_t buffer;
+	}
+	sampled_thread_t;
+
+	std::mutex mutex;
+	std::vector<std::unique_ptr<sampled_thread_t>> threads;
+	bool running;
+	uint32_t hz;
+
+	c_sampler();
+	void disarm(sampled_thread_t& thread);
+public:
+	static c_sampler& instance();
+
+	// Adds the calling thread to the sampled ones; a thread that exits
+	// before the server does must unregister first
+	void register_current_thread(const char* name);
+	void unregister_current_thread();
+
+	bool start(uint32_t hz, std::string& error);
+
+	// Folded stacks of the session, false if none was running
+	bool stop(std::string& folded, size_t* samples = nullptr, size_t* dropped = nullptr);
+
+	bool is_running();
+	uint32_t get_hz();
+};
+
+#endif
@@ -0,0 +1,63 @@
+#include "symbols.h"
+
+#ifdef SYMBOLS_SUPPORTED
+#include <stdlib.h>
+#include <string.h>
+#include <execinfo.h>
+#include <cxxabi.h>
+
+// "./server(_ZN8c_player11send_packetER8c_packet+0x3c) [0x55d0...]" becomes
+// "c_player::send_packet(c_packet&)+0x3c"
+static std::string parse_symbol(const char* symbol, bool with_offset)
+{
+    const char* open = strchr(symbol, '(');
+    const char* plus = open ? strchr(open, '+') : nullptr;
+    const char* close = open ? strchr(open, ')') : nullptr;
+    if (!open || !close || open + 1 == (plus ? plus : close))
+    {
+        if (with_offset || !open)
+            return symbol;
+
+        // Only the module is known, which is still worth grouping by
+        const char* slash = symbol;
+        for (const char* c = symbol; c < open; c++)
+        {
+            if (*c == '/')
+                slash = c + 1;
+        }
+        return "[" + std::string(slash, open) + "]";
+    }
+
+    std::string mangled(open + 1, plus ? plus : close);
+    std::string offset = plus && with_offset ? std::string(plus, close) : std::string();
+
+    int status = 0;
+    char* demangled = abi::__cxa_demangle(mangled.c_str(), nullptr, nullptr, &status);
+    if (status != 0 || !demangled)
+        return mangled + offset;
+
+    std::string name = std::string(demangled) + offset;
+    free(demangled);
+    return name;
+}
+
+std::string symbol_name(void* frame, bool with_offset)
+{
+    char** symbols = backtrace_symbols(&frame, 1);
+    if (!symbols)
+        return "?";
+
+    std::string name = parse_symbol(symbols[0], with_offset);
+    free(symbols);
+    return name;
+}
+#else
+#include <stdio.h>
+
+std::string symbol_name(void* frame, bool)
+{
+    char address[32];
+    snprintf(address, sizeof(address), "%p", frame);
+    return address;
+}
+#endif
@@ -0,0 +1,18 @@
+#ifndef UTIL_SYMBOLS_H
+#define UTIL_SYMBOLS_H
+
+#include <string>
+
+#if defined(__linux__) || defined(__APPLE__)
+#define SYMBOLS_SUPPORTED
+#endif
+
+// Demangled name of the function containing a return address, as
+// "c_player::send_packet(c_packet&)+0x3c" or without the offset. Frames in
+// functions the dynamic symbol table doesn't know (static functions, or a
+// binary linked without -rdynamic) come back as "./server(+0x1234) [...]",
+// or as "[server]" without the offset. Slow, meant for reports and never
+// for signal handlers.
+std::string symbol_name(void* frame, bool with_offset);
+
+#endif
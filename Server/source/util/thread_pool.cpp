@@ -0,0 +1,158 @@
+#include "thread_pool.h"
+#include "profiler.h"
+#include "sampler.h"
+
+#include <stdio.h>
+#include <exception>
+#include <string>
+
+c_thread_pool::c_thread_pool()
+    : generation(0), stopping(false), pending(0), steals(0)
+{
+    this->deques.emplace_back(new work_deque_t());
+}
+
+c_thread_pool::~c_thread_pool()
+{
+    this->stop();
+}
+
+void c_thread_pool::start(size_t workers)
+{
+    this->stop();
+
+    this->stopping = false;
+    this->deques.clear();
+    for (size_t i = 0; i <= workers; i++)
+        this->deques.emplace_back(new work_deque_t());
+
+    for (size_t i = 0; i < workers; i++)
+        this->threads.emplace_back(&c_thread_pool::worker, this, i);
+}
+
+void c_thread_pool::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->wake_mutex);
+        this->stopping = true;
+    }
+    this->wake.notify_all();
+
+    for (std::thread& thread : this->threads)
+    {
+        if (thread.joinable())
+            thread.join();
+    }
+    this->threads.clear();
+}
+
+bool c_thread_pool::try_pop(size_t self, pool_task_t& out)
+{
+    {
+        work_deque_t& own = *this->deques[self];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty())
+        {
+            out = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+
+    size_t count = this->deques.size();
+    for (size_t i = 1; i < count; i++)
+    {
+        work_deque_t& victim = *this->deques[(self + i) % count];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty())
+        {
+            out = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            this->steals.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void c_thread_pool::execute(pool_task_t& task)
+{
+    try
+    {
+        task();
+    }
+    catch (const std::exception& e)
+    {
+        printf("Error in worker task: %s\r\n", e.what());
+    }
+
+    if (this->pending.fetch_sub(1) == 1)
+    {
+        std::lock_guard<std::mutex> lock(this->wake_mutex);
+        this->done.notify_all();
+    }
+}
+
+void c_thread_pool::worker(size_t index)
+{
+    uint64_t seen = 0;
+
+    std::string name = "tick worker " + std::to_string(index + 1);
+    c_profiler::instance().set_thread_name(name.c_str());
+    c_sampler::instance().register_current_thread(name.c_str());
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(this->wake_mutex);
+            this->wake.wait(lock, [&] { return this->stopping || this->generation != seen; });
+            if (this->stopping)
+                break;
+            seen = this->generation;
+        }
+
+        pool_task_t task;
+        while (this->try_pop(index, task))
+            this->execute(task);
+    }
+
+    c_sampler::instance().unregister_current_thread();
+}
+
+void c_thread_pool::run(std::vector<pool_task_t>& tasks)
+{
+    if (tasks.empty())
+        return;
+
+    size_t self = this->deques.size() - 1;
+    if (this->threads.empty())
+    {
+        this->pending += tasks.size();
+        for (pool_task_t& task : tasks)
+            this->execute(task);
+        return;
+    }
+
+    this->pending += tasks.size();
+    for (size_t i = 0; i < tasks.size(); i++)
+    {
+        work_deque_t& target = *this->deques[i % this->deques.size()];
+        std::lock_guard<std::mutex> lock(target.mutex);
+        target.tasks.push_back(std::move(tasks[i]));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(this->wake_mutex);
+        this->generation++;
+    }
+    this->wake.notify_all();
+
+    // The calling thread works too instead of just waiting
+    pool_task_t task;
+    while (this->try_pop(self, task))
+        this->execute(task);
+
+    std::unique_lock<std::mutex> lock(this->wake_mutex);
+    this->done.wait(lock, [&] { return this->pending.load() == 0; });
+}
@@ -0,0 +1,60 @@
+#ifndef UTIL_THREAD_POOL_H
+#define UTIL_THREAD_POOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+typedef std::function<void()> pool_task_t;
+
+// Fork/join pool for the tick. Every worker, and the thread calling run(),
+// owns a deque: it takes work from the back of its own and steals from the
+// front of the others once it runs dry, so uneven batches still balance.
+class c_thread_pool
+{
+private:
+	typedef struct
+	{
+		std::mutex mutex;
+		std::deque<pool_task_t> tasks;
+	}
+	work_deque_t;
+
+	std::vector<std::unique_ptr<work_deque_t>> deques; // last one belongs to the caller
+	std::vector<std::thread> threads;
+
+	std::mutex wake_mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	uint64_t generation;
+	bool stopping;
+	std::atomic<size_t> pending;
+	std::atomic<uint64_t> steals;
+
+	bool try_pop(size_t self, pool_task_t& out);
+	void execute(pool_task_t& task);
+	void worker(size_t index);
+public:
+	c_thread_pool();
+	~c_thread_pool();
+	c_thread_pool(const c_thread_pool&) = delete;
+	c_thread_pool& operator=(const c_thread_pool&) = delete;
+
+	void start(size_t workers);
+	void stop();
+
+	// Runs every task and returns once all of them finished
+	void run(std::vector<pool_task_t>& tasks);
+
+	size_t size() const { return this->threads.size(); }
+	uint64_t get_steals() const { return this->steals.load(std::memory_order_relaxed); }
+};
+
+#endif
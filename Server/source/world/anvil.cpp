@@ -0,0 +1,252 @@
+#include "anvil.h"
+
+#include <stdio.h>
+
+#include "../../libs/libnbt/nbt.h"
+
+// States wider than this can't be sent; ids that large only come from mods
+#define ANVIL_MAX_BLOCK_ID ((1 << (SECTION_GLOBAL_BITS - 4)) - 1)
+
+static inline uint8_t nibble(const uint8_t* array, size_t index)
+{
+    uint8_t pair = array[index >> 1];
+    return (index & 1) ? (pair >> 4) : (pair & 0xF);
+}
+
+// What a section compound holds, pointing into the reader's buffer
+typedef struct
+{
+    int64_t y;
+    bool has_y;
+    const uint8_t* blocks;
+    const uint8_t* data;
+    const uint8_t* add;
+    const uint8_t* block_light;
+    const uint8_t* sky_light;
+}
+section_arrays_t;
+
+static void reader_error(const NBT_Reader& reader, int code, std::string& error)
+{
+    char message[64];
+    snprintf(message, sizeof(message), "NBT error 0x%X at byte %zu", static_cast<unsigned>(code), reader.pos);
+    error = message;
+}
+
+// Byte array of the given length, null when it's something else
+static const uint8_t* byte_array(const NBT_Token& token, int32_t length)
+{
+    if (token.type != TAG_Byte_Array || token.len != length)
+        return nullptr;
+    return token.data;
+}
+
+// Steps over a compound or list the last token opened; other tags were read
+// whole already
+static bool skip(NBT_Reader& reader, const NBT_Token& token, std::string& error)
+{
+    if (token.type != TAG_Compound && token.type != TAG_List)
+        return true;
+
+    int ret = NBT_Reader_Skip(&reader);
+    if (ret < 0)
+    {
+        reader_error(reader, ret, error);
+        return false;
+    }
+    return true;
+}
+
+static bool decode_section(const section_arrays_t& section, c_chunk& chunk, std::string& error)
+{
+    if (!section.has_y)
+    {
+        error = "section without Y";
+        return false;
+    }
+
+    // Light-only sections above the world are written by some versions
+    if (section.y < 0 || section.y >= CHUNK_SECTIONS)
+        return true;
+
+    if (!section.blocks || !section.data || !section.block_light)
+    {
+        error = "section " + std::to_string(section.y) + " is missing block or light arrays";
+        return false;
+    }
+
+    // Anvil keeps blocks in YZX order, the same as SECTION_INDEX
+    block_state_t states[SECTION_BLOCKS];
+    bool empty = true;
+    for (size_t i = 0; i < SECTION_BLOCKS; i++)
+    {
+        uint32_t id = section.blocks[i];
+        if (section.add)
+            id |= static_cast<uint32_t>(nibble(section.add, i)) << 8;
+
+        states[i] = id > ANVIL_MAX_BLOCK_ID ? 0 : BLOCK_STATE(id, nibble(section.data, i));
+        empty &= states[i] == 0;
+    }
+
+    // Sections of nothing but air are left out, like freshly generated ones
+    if (empty)
+        return true;
+
+    c_chunk_section& target = chunk.get_or_create_section(static_cast<int>(section.y));
+    target.load(states);
+    target.load_light(section.block_light, section.sky_light);
+    return true;
+}
+
+// Called once the section compound was entered, leaves the reader after its end
+static bool read_section(NBT_Reader& reader, c_chunk& chunk, std::string& error)
+{
+    section_arrays_t section = {};
+    NBT_Token token;
+    int ret;
+    while ((ret = NBT_Reader_Next(&reader, &token)) > 0 && token.type != TAG_End)
+    {
+        if (NBT_Token_Is(&token, "Y") && token.type == TAG_Byte)
+        {
+            section.y = token.value_i;
+            section.has_y = true;
+        }
+        else if (NBT_Token_Is(&token, "Blocks"))
+            section.blocks = byte_array(token, SECTION_BLOCKS);
+        else if (NBT_Token_Is(&token, "Data"))
+            section.data = byte_array(token, SECTION_LIGHT_BYTES);
+        else if (NBT_Token_Is(&token, "Add"))
+            section.add = byte_array(token, SECTION_LIGHT_BYTES);
+        else if (NBT_Token_Is(&token, "BlockLight"))
+            section.block_light = byte_array(token, SECTION_LIGHT_BYTES);
+        else if (NBT_Token_Is(&token, "SkyLight"))
+            section.sky_light = byte_array(token, SECTION_LIGHT_BYTES);
+
+        // None of the above take a compound or list, even one under their name
+        if (!skip(reader, token, error))
+            return false;
+    }
+    if (ret <= 0)
+    {
+        reader_error(reader, ret ? ret : LIBNBT_ERROR_EARLY_EOF, error);
+        return false;
+    }
+    return decode_section(section, chunk, error);
+}
+
+static bool read_level(NBT_Reader& reader, c_chunk& chunk, std::string& error)
+{
+    const uint8_t* biomes = nullptr;
+    NBT_Token token;
+    int ret;
+    while ((ret = NBT_Reader_Next(&reader, &token)) > 0 && token.type != TAG_End)
+    {
+        if (NBT_Token_Is(&token, "Sections") && token.type == TAG_List)
+        {
+            if (token.len && token.list_type != TAG_Compound)
+            {
+                error = "Sections holds something other than compounds";
+                return false;
+            }
+
+            // Each element opens a compound; the list's own TAG_End ends it
+            NBT_Token element;
+            while ((ret = NBT_Reader_Next(&reader, &element)) > 0 && element.type == TAG_Compound)
+            {
+                if (!read_section(reader, chunk, error))
+                    return false;
+            }
+            if (ret <= 0)
+                break;
+        }
+        else if (NBT_Token_Is(&token, "Sections"))
+        {
+            error = "Sections isn't a list";
+            return false;
+        }
+        else if (NBT_Token_Is(&token, "Biomes"))
+        {
+            // Columns saved before biomes were stored keep the default
+            biomes = byte_array(token, 256);
+            if (!biomes && !skip(reader, token, error))
+                return false;
+        }
+        else if (!skip(reader, token, error))
+        {
+            return false;
+        }
+    }
+    if (ret <= 0)
+    {
+        reader_error(reader, ret ? ret : LIBNBT_ERROR_EARLY_EOF, error);
+        return false;
+    }
+
+    if (biomes)
+        chunk.set_biomes(biomes);
+    return true;
+}
+
+bool anvil_decode_chunk(const region_chunk_t& stored, c_chunk& chunk, std::string& error)
+{
+    if (stored.size < 1)
+    {
+        error = "empty chunk";
+        return false;
+    }
+
+    // The reader only ever reads from the mapping it's handed; compressed
+    // chunks are inflated into a buffer of its own
+    NBT_Reader reader;
+    NBT_Error nbt_error = {};
+    if (NBT_Reader_Init(&reader, const_cast<uint8_t*>(stored.data), stored.size, &nbt_error) != 0)
+    {
+        reader_error(reader, nbt_error.errid, error);
+        return false;
+    }
+
+    // Everything but the sections and biomes is stepped over, without
+    // building a tree or allocating anything
+    NBT_Token token;
+    int ret = NBT_Reader_Next(&reader, &token);
+    bool ok = false;
+    bool found = false;
+    if (ret < 0)
+    {
+        reader_error(reader, ret, error);
+    }
+    else if (token.type != TAG_Compound)
+    {
+        error = "no root compound";
+    }
+    else
+    {
+        ok = true;
+        while (ok && (ret = NBT_Reader_Next(&reader, &token)) > 0 && token.type != TAG_End)
+        {
+            if (!found && NBT_Token_Is(&token, "Level") && token.type == TAG_Compound)
+            {
+                ok = read_level(reader, chunk, error);
+                found = true;
+            }
+            else
+            {
+                ok = skip(reader, token, error);
+            }
+        }
+
+        if (ok && ret <= 0)
+        {
+            reader_error(reader, ret ? ret : LIBNBT_ERROR_EARLY_EOF, error);
+            ok = false;
+        }
+        else if (ok && !found)
+        {
+            error = "no Level compound";
+            ok = false;
+        }
+    }
+
+    NBT_Reader_Free(&reader);
+    return ok;
+}
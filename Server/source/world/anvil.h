@@ -0,0 +1,16 @@
+#ifndef IMPL_ANVIL_H
+#define IMPL_ANVIL_H
+
+#include <string>
+
+#include "chunk.h"
+#include "region.h"
+
+// Fills a column from its NBT as saved by 1.12: numeric block ids in
+// "Blocks" (plus "Add" for ids past 255) and "Data", a nibble array each for
+// block and sky light, sections keyed by "Y". The stored bytes are inflated
+// and read tag by tag, no tree is built; false with a reason when they don't
+// hold a chunk.
+bool anvil_decode_chunk(const region_chunk_t& stored, c_chunk& chunk, std::string& error);
+
+#endif
@@ -0,0 +1,432 @@
+#include "chunk.h"
+
+#include "../protocol/packets.h"
+
+#include <string.h>
+#include <algorithm>
+
+#ifdef _MSC_VER
+#include <stdlib.h>
+#define CHUNK_BSWAP64(x) _byteswap_uint64(x)
+#else
+#define CHUNK_BSWAP64(x) __builtin_bswap64(x)
+#endif
+
+#define IS_AIR(state) (BLOCK_ID(state) == 0)
+
+static void write_var_int(std::vector<uint8_t>& out, uint32_t value)
+{
+    do
+    {
+        uint8_t temp = value & 0x7F;
+        value >>= 7;
+        if (value != 0)
+            temp |= 0x80;
+        out.push_back(temp);
+    }
+    while (value != 0);
+}
+
+static size_t var_int_size(uint32_t value)
+{
+    size_t size = 1;
+    while (value >>= 7)
+        size++;
+    return size;
+}
+
+static uint8_t bits_for(size_t palette_size)
+{
+    uint8_t bits = SECTION_MIN_BITS;
+    while ((static_cast<size_t>(1) << bits) < palette_size)
+        bits++;
+    return bits > SECTION_MAX_PALETTE_BITS ? SECTION_GLOBAL_BITS : bits;
+}
+
+void c_light_array::set(size_t index, uint8_t level)
+{
+    level &= 0xF;
+    if (!this->nibbles)
+    {
+        if (level == this->uniform)
+            return;
+        this->nibbles = std::make_unique<uint8_t[]>(SECTION_LIGHT_BYTES);
+        memset(this->nibbles.get(), this->uniform * 0x11, SECTION_LIGHT_BYTES);
+    }
+
+    uint8_t& pair = this->nibbles[index >> 1];
+    pair = (index & 1) ? static_cast<uint8_t>((pair & 0x0F) | (level << 4)) : static_cast<uint8_t>((pair & 0xF0) | level);
+}
+
+void c_light_array::fill(uint8_t level)
+{
+    this->nibbles.reset();
+    this->uniform = level & 0xF;
+}
+
+void c_light_array::load(const uint8_t* data)
+{
+    bool uniform = (data[0] >> 4) == (data[0] & 0xF);
+    for (size_t i = 1; uniform && i < SECTION_LIGHT_BYTES; i++)
+        uniform = data[i] == data[0];
+
+    if (uniform)
+    {
+        this->fill(data[0] & 0xF);
+        return;
+    }
+
+    if (!this->nibbles)
+        this->nibbles = std::make_unique<uint8_t[]>(SECTION_LIGHT_BYTES);
+    memcpy(this->nibbles.get(), data, SECTION_LIGHT_BYTES);
+}
+
+void c_light_array::write(uint8_t* out) const
+{
+    if (this->nibbles)
+        memcpy(out, this->nibbles.get(), SECTION_LIGHT_BYTES);
+    else
+        memset(out, this->uniform * 0x11, SECTION_LIGHT_BYTES);
+}
+
+c_chunk_section::c_chunk_section()
+    : bits(SECTION_MIN_BITS), mask((1ull << SECTION_MIN_BITS) - 1), non_air(0), block_light(0), sky_light(15)
+{
+    // Everything starts as air, palette index 0
+    this->palette.push_back(0);
+    this->data.assign(SECTION_BLOCKS * SECTION_MIN_BITS / 64, 0);
+}
+
+uint32_t c_chunk_section::get_index(size_t block) const
+{
+    size_t offset = block * this->bits;
+    size_t word = offset >> 6;
+    unsigned shift = offset & 63;
+
+    uint64_t value = this->data[word] >> shift;
+    if (shift + this->bits > 64)
+        value |= this->data[word + 1] << (64 - shift);
+    return static_cast<uint32_t>(value & this->mask);
+}
+
+void c_chunk_section::set_index(size_t block, uint32_t value)
+{
+    size_t offset = block * this->bits;
+    size_t word = offset >> 6;
+    unsigned shift = offset & 63;
+
+    this->data[word] = (this->data[word] & ~(this->mask << shift)) | (static_cast<uint64_t>(value) << shift);
+    if (shift + this->bits > 64)
+    {
+        unsigned spilled = 64 - shift;
+        this->data[word + 1] = (this->data[word + 1] & ~(this->mask >> spilled)) | (static_cast<uint64_t>(value) >> spilled);
+    }
+}
+
+void c_chunk_section::resize(uint8_t bits)
+{
+    bool to_global = bits > SECTION_MAX_PALETTE_BITS && !this->palette.empty();
+
+    uint32_t values[SECTION_BLOCKS];
+    for (size_t i = 0; i < SECTION_BLOCKS; i++)
+        values[i] = to_global ? this->palette[this->get_index(i)] : this->get_index(i);
+
+    if (to_global)
+        this->palette.clear();
+
+    this->bits = bits;
+    this->mask = (1ull << bits) - 1;
+    this->data.assign(SECTION_BLOCKS * bits / 64, 0);
+    for (size_t i = 0; i < SECTION_BLOCKS; i++)
+        this->set_index(i, values[i]);
+}
+
+uint32_t c_chunk_section::palette_index(block_state_t state)
+{
+    if (this->palette.empty())
+        return state;
+
+    // At most 256 entries, and the common ones sit at the front
+    for (size_t i = 0; i < this->palette.size(); i++)
+    {
+        if (this->palette[i] == state)
+            return static_cast<uint32_t>(i);
+    }
+
+    if (this->palette.size() > this->mask)
+    {
+        this->resize(this->bits < SECTION_MAX_PALETTE_BITS ? this->bits + 1 : SECTION_GLOBAL_BITS);
+        if (this->palette.empty())
+            return state;
+    }
+
+    this->palette.push_back(state);
+    return static_cast<uint32_t>(this->palette.size() - 1);
+}
+
+void c_chunk_section::set(size_t block, block_state_t state)
+{
+    block_state_t old = this->get(block);
+    if (old == state)
+        return;
+
+    this->set_index(block, this->palette_index(state));
+
+    if (IS_AIR(old) && !IS_AIR(state))
+        this->non_air++;
+    else if (!IS_AIR(old) && IS_AIR(state))
+        this->non_air--;
+}
+
+void c_chunk_section::load(const block_state_t* states)
+{
+    // State to palette index + 1, cleared again afterwards
+    static thread_local std::vector<uint16_t> lookup(1 << 16, 0);
+
+    this->palette.clear();
+    this->non_air = 0;
+    for (size_t i = 0; i < SECTION_BLOCKS; i++)
+    {
+        block_state_t state = states[i];
+        if (!lookup[state])
+        {
+            this->palette.push_back(state);
+            lookup[state] = static_cast<uint16_t>(this->palette.size());
+        }
+        if (!IS_AIR(state))
+            this->non_air++;
+    }
+
+    this->bits = bits_for(this->palette.size());
+    this->mask = (1ull << this->bits) - 1;
+    this->data.assign(SECTION_BLOCKS * this->bits / 64, 0);
+
+    if (this->bits == SECTION_GLOBAL_BITS)
+    {
+        for (size_t i = 0; i < SECTION_BLOCKS; i++)
+            this->set_index(i, states[i]);
+    }
+    else
+    {
+        for (size_t i = 0; i < SECTION_BLOCKS; i++)
+            this->set_index(i, lookup[states[i]] - 1u);
+    }
+
+    for (block_state_t state : this->palette)
+        lookup[state] = 0;
+    if (this->bits == SECTION_GLOBAL_BITS)
+        this->palette.clear();
+    this->palette.shrink_to_fit();
+}
+
+void c_chunk_section::load_light(const uint8_t* block, const uint8_t* sky)
+{
+    this->block_light.load(block);
+    if (sky)
+        this->sky_light.load(sky);
+}
+
+size_t c_chunk_section::get_encoded_size(bool sky_light) const
+{
+    size_t size = 1 + var_int_size(static_cast<uint32_t>(this->palette.size()));
+    for (block_state_t state : this->palette)
+        size += var_int_size(state);
+    size += var_int_size(static_cast<uint32_t>(this->data.size())) + this->data.size() * 8;
+    size += sky_light ? 2 * SECTION_LIGHT_BYTES : SECTION_LIGHT_BYTES;
+    return size;
+}
+
+void c_chunk_section::encode(std::vector<uint8_t>& out, bool sky_light) const
+{
+    out.push_back(this->bits);
+
+    // The global palette still writes an empty palette
+    write_var_int(out, static_cast<uint32_t>(this->palette.size()));
+    for (block_state_t state : this->palette)
+        write_var_int(out, state);
+
+    write_var_int(out, static_cast<uint32_t>(this->data.size()));
+    size_t at = out.size();
+    out.resize(at + this->data.size() * 8 + (sky_light ? 2 * SECTION_LIGHT_BYTES : SECTION_LIGHT_BYTES));
+
+    // Big endian longs on the wire
+    uint8_t* longs = out.data() + at;
+    for (size_t i = 0; i < this->data.size(); i++)
+    {
+        uint64_t swapped = CHUNK_BSWAP64(this->data[i]);
+        memcpy(longs + i * 8, &swapped, 8);
+    }
+
+    uint8_t* light = longs + this->data.size() * 8;
+    this->block_light.write(light);
+    if (sky_light)
+        this->sky_light.write(light + SECTION_LIGHT_BYTES);
+}
+
+size_t c_chunk_section::get_memory_usage() const
+{
+    return sizeof(*this) + this->data.capacity() * sizeof(uint64_t) + this->palette.capacity() * sizeof(block_state_t) +
+        this->block_light.get_memory_usage() + this->sky_light.get_memory_usage();
+}
+
+c_chunk::c_chunk(chunk_pos_t pos, chunk_cache_stats_t* stats)
+    : pos(pos), stats(stats), packet_sky_light(false)
+{
+    // Plains
+    memset(this->biomes, 1, sizeof(this->biomes));
+}
+
+c_chunk::~c_chunk()
+{
+    this->invalidate();
+}
+
+block_state_t c_chunk::get_block_state(int32_t x, int32_t y, int32_t z) const
+{
+    if (y < WORLD_MIN_Y || y > WORLD_MAX_Y)
+        return 0;
+
+    const c_chunk_section* section = this->sections[y >> 4].get();
+    return section ? section->get(SECTION_INDEX(x, y, z)) : 0;
+}
+
+void c_chunk::set_block_state(int32_t x, int32_t y, int32_t z, block_state_t state)
+{
+    if (y < WORLD_MIN_Y || y > WORLD_MAX_Y)
+        return;
+
+    if (!this->sections[y >> 4] && IS_AIR(state))
+        return;
+
+    std::unique_ptr<c_chunk_section>& section = this->sections[y >> 4];
+    if (!section)
+        section = std::make_unique<c_chunk_section>();
+    else if (section->get(SECTION_INDEX(x, y, z)) == state)
+        return;
+
+    section->set(SECTION_INDEX(x, y, z), state);
+    this->invalidate();
+}
+
+void c_chunk::set_block_light(int32_t x, int32_t y, int32_t z, uint8_t level)
+{
+    if (y < WORLD_MIN_Y || y > WORLD_MAX_Y)
+        return;
+
+    this->get_or_create_section(y >> 4).set_block_light(SECTION_INDEX(x, y, z), level);
+    this->invalidate();
+}
+
+void c_chunk::set_sky_light(int32_t x, int32_t y, int32_t z, uint8_t level)
+{
+    if (y < WORLD_MIN_Y || y > WORLD_MAX_Y)
+        return;
+
+    this->get_or_create_section(y >> 4).set_sky_light(SECTION_INDEX(x, y, z), level);
+    this->invalidate();
+}
+
+c_chunk_section& c_chunk::get_or_create_section(int index)
+{
+    if (!this->sections[index])
+        this->sections[index] = std::make_unique<c_chunk_section>();
+    this->invalidate();
+    return *this->sections[index];
+}
+
+void c_chunk::set_biomes(const uint8_t* biomes)
+{
+    memcpy(this->biomes, biomes, sizeof(this->biomes));
+    this->invalidate();
+}
+
+void c_chunk::invalidate()
+{
+    std::lock_guard<std::mutex> lock(this->packet_mutex);
+    if (!this->packet)
+        return;
+
+    if (this->stats)
+        this->stats->cached_bytes -= static_cast<int64_t>(this->packet->size());
+    this->packet.reset();
+}
+
+uint16_t c_chunk::get_section_mask() const
+{
+    uint16_t mask = 0;
+    for (int i = 0; i < CHUNK_SECTIONS; i++)
+    {
+        if (this->sections[i] && !this->sections[i]->is_empty())
+            mask |= 1 << i;
+    }
+    return mask;
+}
+
+void c_chunk::encode(std::vector<uint8_t>& out, bool sky_light) const
+{
+    uint16_t mask = this->get_section_mask();
+
+    size_t size = sizeof(this->biomes);
+    for (int i = 0; i < CHUNK_SECTIONS; i++)
+    {
+        if (mask & (1 << i))
+            size += this->sections[i]->get_encoded_size(sky_light);
+    }
+    out.reserve(out.size() + size);
+
+    for (int i = 0; i < CHUNK_SECTIONS; i++)
+    {
+        if (mask & (1 << i))
+            this->sections[i]->encode(out, sky_light);
+    }
+    out.insert(out.end(), this->biomes, this->biomes + sizeof(this->biomes));
+}
+
+packet_buffer_t c_chunk::get_packet(bool sky_light) const
+{
+    std::lock_guard<std::mutex> lock(this->packet_mutex);
+    if (this->packet && this->packet_sky_light == sky_light)
+    {
+        if (this->stats)
+            this->stats->packet_hits++;
+        return this->packet;
+    }
+
+    std::vector<uint8_t> data;
+    this->encode(data, sky_light);
+
+    c_packet packet;
+    c_s2c_chunk_data chunk_data = c_s2c_chunk_data
+    (
+        this->pos.x, this->pos.z,
+        1,
+        this->get_section_mask(),
+        std::move(data),
+        0,
+        ""
+    );
+    chunk_data.serialize(packet);
+
+    if (this->stats)
+    {
+        if (this->packet)
+            this->stats->cached_bytes -= static_cast<int64_t>(this->packet->size());
+        this->stats->cached_bytes += static_cast<int64_t>(packet.get_size());
+        this->stats->packet_builds++;
+    }
+
+    this->packet = std::make_shared<const std::vector<uint8_t>>(std::move(packet.get_raw()));
+    this->packet_sky_light = sky_light;
+    return this->packet;
+}
+
+size_t c_chunk::get_memory_usage() const
+{
+    size_t size = sizeof(*this);
+    for (int i = 0; i < CHUNK_SECTIONS; i++)
+    {
+        if (this->sections[i])
+            size += this->sections[i]->get_memory_usage();
+    }
+    return size;
+}
@@ -0,0 +1,159 @@
+#ifndef IMPL_CHUNK_H
+#define IMPL_CHUNK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "world.h"
+#include "../protocol/packet.h"
+
+#define CHUNK_SECTIONS			16
+#define SECTION_BLOCKS			4096
+#define SECTION_LIGHT_BYTES		2048		// a nibble per block
+
+// Indices narrower than 4 bits aren't understood by the client, wider than
+// 8 bits switch to global state ids
+#define SECTION_MIN_BITS		4
+#define SECTION_MAX_PALETTE_BITS	8
+#define SECTION_GLOBAL_BITS		13		// what the 1.12 client expects for global ids
+
+#define SECTION_INDEX(x, y, z) ((((y) & 0xF) << 8) | (((z) & 0xF) << 4) | ((x) & 0xF))
+
+// Light of a section, stored as the nibble array the protocol sends. Most
+// sections are lit uniformly (fully lit sky, unlit stone), so the array is
+// only allocated once a block differs from the rest.
+class c_light_array
+{
+private:
+	std::unique_ptr<uint8_t[]> nibbles;
+	uint8_t uniform;
+public:
+	explicit c_light_array(uint8_t level = 0) : uniform(level & 0xF) {}
+
+	uint8_t get(size_t index) const
+	{
+		if (!this->nibbles)
+			return this->uniform;
+		uint8_t pair = this->nibbles[index >> 1];
+		return (index & 1) ? (pair >> 4) : (pair & 0xF);
+	}
+
+	void set(size_t index, uint8_t level);
+	void fill(uint8_t level);
+	void load(const uint8_t* data);		// SECTION_LIGHT_BYTES, as in the anvil format
+	void write(uint8_t* out) const;		// SECTION_LIGHT_BYTES
+
+	size_t get_memory_usage() const { return this->nibbles ? SECTION_LIGHT_BYTES : 0; }
+};
+
+// 16x16x16 blocks in the layout the 1.12 protocol sends them: indices into
+// a section local palette, bit packed into longs where an index may straddle
+// two longs. The palette grows a bit at a time as states are added; past
+// 8 bits the global state ids are stored directly. Encoding is the palette
+// followed by a byte swapped copy of the longs.
+class c_chunk_section
+{
+private:
+	std::vector<block_state_t> palette;		// empty with global ids
+	std::vector<uint64_t> data;
+	uint8_t bits;
+	uint64_t mask;
+	uint16_t non_air;
+	c_light_array block_light;
+	c_light_array sky_light;
+
+	uint32_t get_index(size_t block) const;
+	void set_index(size_t block, uint32_t value);
+	void resize(uint8_t bits);
+	uint32_t palette_index(block_state_t state);
+public:
+	c_chunk_section();
+
+	block_state_t get(size_t block) const
+	{
+		uint32_t value = this->get_index(block);
+		return this->palette.empty() ? static_cast<block_state_t>(value) : this->palette[value];
+	}
+
+	void set(size_t block, block_state_t state);
+
+	// Replaces the whole section, states in SECTION_INDEX order; picks the
+	// smallest width that fits the distinct states at once
+	void load(const block_state_t* states);
+
+	uint8_t get_block_light(size_t block) const { return this->block_light.get(block); }
+	uint8_t get_sky_light(size_t block) const { return this->sky_light.get(block); }
+	void set_block_light(size_t block, uint8_t level) { this->block_light.set(block, level); }
+	void set_sky_light(size_t block, uint8_t level) { this->sky_light.set(block, level); }
+
+	// SECTION_LIGHT_BYTES each as stored in anvil, sky may be null
+	void load_light(const uint8_t* block, const uint8_t* sky);
+
+	bool is_empty() const { return this->non_air == 0; }
+	uint8_t get_bits() const { return this->bits; }
+	size_t get_palette_size() const { return this->palette.size(); }
+
+	size_t get_encoded_size(bool sky_light) const;
+	void encode(std::vector<uint8_t>& out, bool sky_light) const;
+
+	size_t get_memory_usage() const;
+};
+
+// A 16 blocks wide column of up to 16 sections. Sections that only hold
+// air aren't allocated and aren't sent.
+//
+// The framed chunk data packet is built on the first send and kept, so
+// every player entering the chunk queues the same buffer; any edit drops
+// it and the next send encodes again. Encoding a section costs about as
+// much as copying it, so only whole packets are cached.
+class c_chunk
+{
+private:
+	chunk_pos_t pos;
+	std::unique_ptr<c_chunk_section> sections[CHUNK_SECTIONS];
+	uint8_t biomes[256];
+
+	chunk_cache_stats_t* stats;
+	mutable std::mutex packet_mutex;
+	mutable packet_buffer_t packet;
+	mutable bool packet_sky_light;
+public:
+	explicit c_chunk(chunk_pos_t pos, chunk_cache_stats_t* stats = nullptr);
+	~c_chunk();
+
+	chunk_pos_t get_pos() const { return this->pos; }
+
+	// Coordinates inside the column: x and z in 0..15, y in 0..255
+	block_state_t get_block_state(int32_t x, int32_t y, int32_t z) const;
+	void set_block_state(int32_t x, int32_t y, int32_t z, block_state_t state);
+	void set_block_light(int32_t x, int32_t y, int32_t z, uint8_t level);
+	void set_sky_light(int32_t x, int32_t y, int32_t z, uint8_t level);
+
+	const c_chunk_section* get_section(int index) const { return this->sections[index].get(); }
+
+	// For editing a section directly, which drops the cached packet
+	c_chunk_section& get_or_create_section(int index);
+
+	const uint8_t* get_biomes() const { return this->biomes; }
+	void set_biomes(const uint8_t* biomes);
+
+	void set_stats(chunk_cache_stats_t* stats) { this->stats = stats; }
+	void invalidate();
+
+	// Bit per section that isn't empty
+	uint16_t get_section_mask() const;
+
+	// Data field of a full chunk data packet: the sections in the mask,
+	// then the biomes
+	void encode(std::vector<uint8_t>& out, bool sky_light) const;
+
+	// The framed Chunk Data packet; safe to call from several threads
+	packet_buffer_t get_packet(bool sky_light) const;
+
+	size_t get_memory_usage() const;
+};
+
+#endif
@@ -0,0 +1,206 @@
+#include "chunk_loader.h"
+#include "anvil.h"
+
+#include "../util/profiler.h"
+#include "../util/sampler.h"
+#include "../../libs/libnbt/nbt.h"
+
+#include <stdio.h>
+#include <algorithm>
+
+c_chunk_loader::c_chunk_loader()
+    : stopping(false)
+{
+    this->stats.loaded = 0;
+    this->stats.missing = 0;
+    this->stats.failed = 0;
+    this->stats.cancelled = 0;
+}
+
+c_chunk_loader::~c_chunk_loader()
+{
+    this->stop();
+}
+
+void c_chunk_loader::start(const std::string& directory, size_t threads, size_t region_cache)
+{
+    this->stop();
+
+    this->regions.configure(directory, region_cache);
+    this->stopping = false;
+    for (size_t i = 0; i < threads; i++)
+        this->threads.emplace_back(&c_chunk_loader::worker, this, i);
+}
+
+void c_chunk_loader::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->wake.notify_all();
+
+    for (std::thread& thread : this->threads)
+    {
+        if (thread.joinable())
+            thread.join();
+    }
+    this->threads.clear();
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->queue.clear();
+    this->requests.clear();
+    this->done.clear();
+}
+
+std::unique_ptr<c_chunk> c_chunk_loader::load(chunk_pos_t pos)
+{
+    std::unique_ptr<c_chunk> chunk(new c_chunk(pos));
+
+    region_chunk_t stored;
+    std::shared_ptr<c_region_file> region;
+    {
+        PROFILE_SCOPE("region read");
+        if (!this->regions.read_chunk(pos, stored, region))
+        {
+            this->stats.missing++;
+            return chunk;
+        }
+    }
+
+    PROFILE_SCOPE("chunk decode");
+    std::string error;
+    if (anvil_decode_chunk(stored, *chunk, error))
+    {
+        this->stats.loaded++;
+        return chunk;
+    }
+
+    // Whatever was decoded before the error is dropped, half a column would
+    // be worse than none
+    printf("Chunk %d, %d couldn't be loaded: %s\r\n", pos.x, pos.z, error.c_str());
+    this->stats.failed++;
+    return std::unique_ptr<c_chunk>(new c_chunk(pos));
+}
+
+void c_chunk_loader::worker(size_t index)
+{
+    std::string name = "chunk loader " + std::to_string(index + 1);
+    c_profiler::instance().set_thread_name(name.c_str());
+    c_sampler::instance().register_current_thread(name.c_str());
+
+    while (true)
+    {
+        uint64_t key;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->wake.wait(lock, [this] { return this->stopping || !this->queue.empty(); });
+            if (this->stopping)
+                break;
+
+            key = this->queue.begin()->second;
+            this->queue.erase(this->queue.begin());
+            this->requests[key].state = load_running;
+        }
+
+        std::unique_ptr<c_chunk> chunk = this->load(chunk_from_key(key));
+
+        std::lock_guard<std::mutex> lock(this->mutex);
+        auto request = this->requests.find(key);
+        if (request == this->requests.end())
+            continue;
+
+        if (request->second.state == load_cancelled)
+        {
+            this->requests.erase(request);
+            this->stats.cancelled++;
+            continue;
+        }
+
+        request->second.state = load_done;
+        this->done.push_back(std::move(chunk));
+    }
+
+    NBT_Release_Thread();
+    c_sampler::instance().unregister_current_thread();
+}
+
+void c_chunk_loader::update(const std::unordered_map<uint64_t, uint32_t>& wanted)
+{
+    size_t added = 0;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+
+        for (auto it = this->requests.begin(); it != this->requests.end();)
+        {
+            if (wanted.count(it->first))
+            {
+                ++it;
+                continue;
+            }
+
+            // Finished columns are still handed out, the world drops them
+            // again with the others nobody looks at
+            if (it->second.state == load_queued)
+            {
+                this->queue.erase({ it->second.priority, it->first });
+                it = this->requests.erase(it);
+                this->stats.cancelled++;
+                continue;
+            }
+
+            if (it->second.state == load_running)
+                it->second.state = load_cancelled;
+            ++it;
+        }
+
+        for (auto& x : wanted)
+        {
+            auto found = this->requests.find(x.first);
+            if (found == this->requests.end())
+            {
+                this->requests[x.first] = { x.second, load_queued };
+                this->queue.insert({ x.second, x.first });
+                added++;
+                continue;
+            }
+
+            load_request_t& request = found->second;
+            if (request.state == load_queued && request.priority != x.second)
+            {
+                this->queue.erase({ request.priority, x.first });
+                this->queue.insert({ x.second, x.first });
+            }
+            else if (request.state == load_cancelled)
+            {
+                request.state = load_running;
+            }
+            request.priority = x.second;
+        }
+    }
+
+    if (added == 1)
+        this->wake.notify_one();
+    else if (added)
+        this->wake.notify_all();
+}
+
+size_t c_chunk_loader::collect(std::vector<std::unique_ptr<c_chunk>>& out, size_t max)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    size_t count = std::min(max, this->done.size());
+    for (size_t i = 0; i < count; i++)
+    {
+        this->requests.erase(chunk_key(this->done[i]->get_pos()));
+        out.push_back(std::move(this->done[i]));
+    }
+    this->done.erase(this->done.begin(), this->done.begin() + count);
+    return count;
+}
+
+size_t c_chunk_loader::get_pending()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->requests.size();
+}
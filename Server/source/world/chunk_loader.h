@@ -0,0 +1,94 @@
+#ifndef IMPL_CHUNK_LOADER_H
+#define IMPL_CHUNK_LOADER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "world.h"
+#include "chunk.h"
+#include "region.h"
+
+typedef struct
+{
+	std::atomic<uint64_t> loaded;		// read from a region file
+	std::atomic<uint64_t> missing;		// never generated, handed out empty
+	std::atomic<uint64_t> failed;		// unreadable, handed out empty
+	std::atomic<uint64_t> cancelled;	// nobody wanted them any more
+}
+chunk_load_stats_t;
+
+// Loads chunk columns from a world's region files on threads of its own:
+// the region read, inflating, NBT parsing and building the sections all
+// happen off the tick thread. The nearest requests are served first.
+//
+// The tick thread tells the loader every tick which columns it's waiting
+// for, and picks up finished ones in batches it can add to the world
+// between region phases. A column that drops out of the wanted set is
+// cancelled; one already being decoded is thrown away once done.
+class c_chunk_loader
+{
+private:
+	typedef enum
+	{
+		load_queued,
+		load_running,
+		load_cancelled,		// running, but no longer wanted
+		load_done
+	}
+	load_state_t;
+
+	typedef struct
+	{
+		uint32_t priority;
+		load_state_t state;
+	}
+	load_request_t;
+
+	c_region_cache regions;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::set<std::pair<uint32_t, uint64_t>> queue;		// priority, chunk key; nearest first
+	std::unordered_map<uint64_t, load_request_t> requests;
+	std::vector<std::unique_ptr<c_chunk>> done;
+	std::vector<std::thread> threads;
+	bool stopping;
+	chunk_load_stats_t stats;
+
+	void worker(size_t index);
+	std::unique_ptr<c_chunk> load(chunk_pos_t pos);
+public:
+	c_chunk_loader();
+	~c_chunk_loader();
+	c_chunk_loader(const c_chunk_loader&) = delete;
+	c_chunk_loader& operator=(const c_chunk_loader&) = delete;
+
+	void start(const std::string& directory, size_t threads, size_t region_cache);
+	void stop();
+	bool is_running() const { return !this->threads.empty(); }
+
+	// Tick thread. Every column still wanted, by chunk key, with its squared
+	// distance in chunks to the nearest player waiting for it; requests that
+	// aren't in here any more are cancelled.
+	void update(const std::unordered_map<uint64_t, uint32_t>& wanted);
+
+	// Tick thread. Moves up to max finished columns, oldest first, into out;
+	// columns that don't exist on disk come back empty.
+	size_t collect(std::vector<std::unique_ptr<c_chunk>>& out, size_t max);
+
+	// Requests not handed out yet, including finished ones
+	size_t get_pending();
+	size_t get_open_regions() { return this->regions.get_open_count(); }
+	const chunk_load_stats_t& get_stats() const { return this->stats; }
+};
+
+#endif
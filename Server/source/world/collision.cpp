@@ -0,0 +1,377 @@
+#include "collision.h"
+
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define COLLISION_SSE2
+#include <emmintrin.h>
+#endif
+
+// Blocks are skipped when the player box only touches them by this much,
+// so standing on or sliding along a surface is never flagged.
+#define COLLISION_EPSILON 0.01f
+
+// Padding box that can never be entered by a move of sane length
+#define COLLISION_FAR 1.0e6f
+
+#define PX(n) ((n) / 16.f)
+
+static const aabbf_t shape_full[]           = { { 0.f, 0.f, 0.f, 1.f, 1.f, 1.f } };
+static const aabbf_t shape_slab_bottom[]    = { { 0.f, 0.f, 0.f, 1.f, 0.5f, 1.f } };
+static const aabbf_t shape_slab_top[]       = { { 0.f, 0.5f, 0.f, 1.f, 1.f, 1.f } };
+static const aabbf_t shape_farmland[]       = { { 0.f, 0.f, 0.f, 1.f, PX(15), 1.f } };
+static const aabbf_t shape_soul_sand[]      = { { 0.f, 0.f, 0.f, 1.f, PX(14), 1.f } };
+static const aabbf_t shape_cactus[]         = { { PX(1), 0.f, PX(1), PX(15), PX(15), PX(15) } };
+static const aabbf_t shape_cake[]           = { { PX(1), 0.f, PX(1), PX(15), 0.5f, PX(15) } };
+static const aabbf_t shape_bed[]            = { { 0.f, 0.f, 0.f, 1.f, PX(9), 1.f } };
+static const aabbf_t shape_chest[]          = { { PX(1), 0.f, PX(1), PX(15), PX(14), PX(15) } };
+static const aabbf_t shape_enchanting[]     = { { 0.f, 0.f, 0.f, 1.f, PX(12), 1.f } };
+static const aabbf_t shape_portal_frame[]   = { { 0.f, 0.f, 0.f, 1.f, PX(13), 1.f } };
+static const aabbf_t shape_daylight[]       = { { 0.f, 0.f, 0.f, 1.f, PX(6), 1.f } };
+static const aabbf_t shape_diode[]          = { { 0.f, 0.f, 0.f, 1.f, PX(2), 1.f } };
+static const aabbf_t shape_carpet[]         = { { 0.f, 0.f, 0.f, 1.f, PX(1), 1.f } };
+static const aabbf_t shape_lily_pad[]       = { { PX(1), 0.f, PX(1), PX(15), PX(1.5f), PX(15) } };
+static const aabbf_t shape_fence[]          = { { PX(6), 0.f, PX(6), PX(10), 1.5f, PX(10) } };
+static const aabbf_t shape_wall[]           = { { PX(4), 0.f, PX(4), PX(12), 1.5f, PX(12) } };
+static const aabbf_t shape_cauldron[]       = { { 0.f, 0.f, 0.f, 1.f, PX(5), 1.f } };
+static const aabbf_t shape_hopper[]         = { { 0.f, PX(10), 0.f, 1.f, 1.f, 1.f } };
+static const aabbf_t shape_flower_pot[]     = { { PX(5), 0.f, PX(5), PX(11), PX(6), PX(11) } };
+static const aabbf_t shape_dragon_egg[]     = { { PX(1), 0.f, PX(1), PX(15), 1.f, PX(15) } };
+
+// Blocks without collision, or whose collision depends on state we do not
+// track (doors, gates, trapdoors, panes, ladders, pistons heads, ...)
+static const uint8_t passable_blocks[] =
+{
+    0, 6, 8, 9, 10, 11, 27, 28, 30, 31, 32, 34, 36, 37, 38, 39, 40, 50, 51, 55,
+    59, 63, 64, 65, 66, 68, 69, 70, 71, 72, 75, 76, 77, 83, 90, 96, 101, 102,
+    104, 105, 106, 107, 115, 117, 119, 127, 131, 132, 141, 142, 143, 144, 145,
+    147, 148, 157, 160, 167, 175, 176, 177, 183, 184, 185, 186, 187, 193, 194,
+    195, 196, 197, 198, 207, 209, 217
+};
+
+static const uint8_t slab_blocks[] = { 44, 126, 182, 205 };
+
+static const uint8_t stair_blocks[] =
+{
+    53, 67, 108, 109, 114, 128, 134, 135, 136, 156, 163, 164, 180, 203
+};
+
+static const uint8_t fence_blocks[] = { 85, 113, 188, 189, 190, 191, 192 };
+
+#define ARRAY_COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+c_block_shapes::c_block_shapes()
+{
+    // Every state starts out as a full cube, the exceptions are listed below
+    this->index.assign(4096, 0);
+    this->boxes.reserve(64);
+    this->set_all(0, nullptr, 0);
+    for (int id = 1; id < 256; id++)
+        this->set_all(id, shape_full, 1);
+
+    for (uint8_t id : passable_blocks)
+        this->set_all(id, nullptr, 0);
+
+    for (uint8_t id : slab_blocks)
+    {
+        for (int meta = 0; meta < 16; meta++)
+            this->set(id, meta, (meta & 8) ? shape_slab_top : shape_slab_bottom, 1);
+    }
+
+    // Only the half slab part of stairs, the step itself depends on facing
+    for (uint8_t id : stair_blocks)
+    {
+        for (int meta = 0; meta < 16; meta++)
+            this->set(id, meta, (meta & 4) ? shape_slab_top : shape_slab_bottom, 1);
+    }
+
+    for (uint8_t id : fence_blocks)
+        this->set_all(id, shape_fence, 1);
+
+    // Snow layers collide one layer lower than they render
+    for (int meta = 0; meta < 16; meta++)
+    {
+        int layers = (meta & 7) + 1;
+        if (layers == 1)
+        {
+            this->set(78, meta, nullptr, 0);
+            continue;
+        }
+
+        aabbf_t snow = { 0.f, 0.f, 0.f, 1.f, (layers - 1) / 8.f, 1.f };
+        this->set(78, meta, &snow, 1);
+    }
+
+    // Extended pistons share their space with the head
+    for (int meta = 8; meta < 16; meta++)
+    {
+        this->set(29, meta, nullptr, 0);
+        this->set(33, meta, nullptr, 0);
+    }
+
+    this->set_all(26, shape_bed, 1);
+    this->set_all(54, shape_chest, 1);
+    this->set_all(60, shape_farmland, 1);
+    this->set_all(81, shape_cactus, 1);
+    this->set_all(88, shape_soul_sand, 1);
+    this->set_all(92, shape_cake, 1);
+    this->set_all(93, shape_diode, 1);
+    this->set_all(94, shape_diode, 1);
+    this->set_all(111, shape_lily_pad, 1);
+    this->set_all(116, shape_enchanting, 1);
+    this->set_all(118, shape_cauldron, 1);
+    this->set_all(120, shape_portal_frame, 1);
+    this->set_all(122, shape_dragon_egg, 1);
+    this->set_all(130, shape_chest, 1);
+    this->set_all(139, shape_wall, 1);
+    this->set_all(140, shape_flower_pot, 1);
+    this->set_all(146, shape_chest, 1);
+    this->set_all(149, shape_diode, 1);
+    this->set_all(150, shape_diode, 1);
+    this->set_all(151, shape_daylight, 1);
+    this->set_all(154, shape_hopper, 1);
+    this->set_all(171, shape_carpet, 1);
+    this->set_all(178, shape_daylight, 1);
+}
+
+void c_block_shapes::set(uint8_t block_id, int meta, const aabbf_t* shape, uint32_t count)
+{
+    uint32_t offset = 0;
+    if (count)
+    {
+        // Most states share one of a handful of shapes, reuse them
+        bool found = false;
+        for (size_t i = 0; i + count <= this->boxes.size() && !found; i++)
+        {
+            found = true;
+            for (uint32_t j = 0; j < count && found; j++)
+            {
+                const aabbf_t& a = this->boxes[i + j];
+                const aabbf_t& b = shape[j];
+                found = a.min_x == b.min_x && a.min_y == b.min_y && a.min_z == b.min_z &&
+                    a.max_x == b.max_x && a.max_y == b.max_y && a.max_z == b.max_z;
+            }
+            offset = static_cast<uint32_t>(i);
+        }
+
+        if (!found)
+        {
+            offset = static_cast<uint32_t>(this->boxes.size());
+            this->boxes.insert(this->boxes.end(), shape, shape + count);
+        }
+    }
+
+    this->index[BLOCK_STATE(block_id, meta)] = (offset << 8) | count;
+}
+
+void c_block_shapes::set_all(uint8_t block_id, const aabbf_t* shape, uint32_t count)
+{
+    for (int meta = 0; meta < 16; meta++)
+        this->set(block_id, meta, shape, count);
+}
+
+const aabbf_t* c_block_shapes::get(block_state_t state, uint32_t& count) const
+{
+    if (state >= this->index.size())
+    {
+        count = 0;
+        return nullptr;
+    }
+
+    uint32_t entry = this->index[state];
+    count = entry & 0xFF;
+    return count ? &this->boxes[entry >> 8] : nullptr;
+}
+
+const c_block_shapes& c_block_shapes::instance()
+{
+    static const c_block_shapes shapes;
+    return shapes;
+}
+
+void c_collision_batch::clear()
+{
+    this->min_x.clear(); this->min_y.clear(); this->min_z.clear();
+    this->max_x.clear(); this->max_y.clear(); this->max_z.clear();
+    this->count = 0;
+}
+
+void c_collision_batch::push(float x0, float y0, float z0, float x1, float y1, float z1)
+{
+    this->min_x.push_back(x0); this->min_y.push_back(y0); this->min_z.push_back(z0);
+    this->max_x.push_back(x1); this->max_y.push_back(y1); this->max_z.push_back(z1);
+    this->count++;
+}
+
+void c_collision_batch::pad()
+{
+    // Degenerate boxes far away, so the SIMD loop never needs a tail
+    while (this->min_x.size() % 4)
+    {
+        this->min_x.push_back(COLLISION_FAR); this->min_y.push_back(COLLISION_FAR); this->min_z.push_back(COLLISION_FAR);
+        this->max_x.push_back(COLLISION_FAR); this->max_y.push_back(COLLISION_FAR); this->max_z.push_back(COLLISION_FAR);
+    }
+}
+
+static inline float safe_inverse(float d)
+{
+    // A zero component would produce 0 * inf = NaN in the slab test
+    if (std::fabs(d) < 1.0e-9f)
+        d = d < 0.f ? -1.0e-9f : 1.0e-9f;
+    return 1.f / d;
+}
+
+bool c_collision_batch::sweep(float ox, float oy, float oz, float dx, float dy, float dz) const
+{
+    // Slab test of the segment origin + t * delta, t in [0, 1), against every
+    // box. Boxes the segment starts inside of are ignored so a player that is
+    // already stuck can always move out.
+    float ix = safe_inverse(dx);
+    float iy = safe_inverse(dy);
+    float iz = safe_inverse(dz);
+    size_t padded = this->min_x.size();
+
+#ifdef COLLISION_SSE2
+    const __m128 o_x = _mm_set1_ps(ox), o_y = _mm_set1_ps(oy), o_z = _mm_set1_ps(oz);
+    const __m128 i_x = _mm_set1_ps(ix), i_y = _mm_set1_ps(iy), i_z = _mm_set1_ps(iz);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.f);
+
+    for (size_t i = 0; i < padded; i += 4)
+    {
+        __m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&this->min_x[i]), o_x), i_x);
+        __m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&this->max_x[i]), o_x), i_x);
+        __m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&this->min_y[i]), o_y), i_y);
+        __m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&this->max_y[i]), o_y), i_y);
+        __m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&this->min_z[i]), o_z), i_z);
+        __m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&this->max_z[i]), o_z), i_z);
+
+        __m128 enter = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)), _mm_min_ps(t0z, t1z));
+        __m128 exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)), _mm_max_ps(t0z, t1z));
+
+        __m128 hit = _mm_and_ps(_mm_cmplt_ps(enter, exit),
+            _mm_and_ps(_mm_cmpge_ps(enter, zero), _mm_cmplt_ps(enter, one)));
+
+        if (_mm_movemask_ps(hit))
+            return true;
+    }
+#else
+    for (size_t i = 0; i < padded; i++)
+    {
+        float t0x = (this->min_x[i] - ox) * ix, t1x = (this->max_x[i] - ox) * ix;
+        float t0y = (this->min_y[i] - oy) * iy, t1y = (this->max_y[i] - oy) * iy;
+        float t0z = (this->min_z[i] - oz) * iz, t1z = (this->max_z[i] - oz) * iz;
+
+        float enter = std::fmax(std::fmax(std::fmin(t0x, t1x), std::fmin(t0y, t1y)), std::fmin(t0z, t1z));
+        float exit = std::fmin(std::fmin(std::fmax(t0x, t1x), std::fmax(t0y, t1y)), std::fmax(t0z, t1z));
+
+        if (enter < exit && enter >= 0.f && enter < 1.f)
+            return true;
+    }
+#endif
+
+    return false;
+}
+
+// Axis orders tried when the straight path is blocked; the client resolves
+// its movement one axis at a time, so stepping up or sliding around a corner
+// can clip a block on the diagonal while being perfectly legal.
+static const uint8_t axis_orders[6][3] =
+{
+    { 1, 0, 2 }, { 1, 2, 0 }, { 0, 2, 1 }, { 2, 0, 1 }, { 0, 1, 2 }, { 2, 1, 0 }
+};
+
+bool collision_sweep(const c_world& world, const vec3d_t& from, const vec3d_t& to)
+{
+    thread_local c_collision_batch batch;
+    const c_block_shapes& shapes = c_block_shapes::instance();
+
+    const double half_width = PLAYER_WIDTH / 2.0;
+
+    double lo_x = std::fmin(from.x, to.x) - half_width;
+    double hi_x = std::fmax(from.x, to.x) + half_width;
+    double lo_y = std::fmin(from.y, to.y);
+    double hi_y = std::fmax(from.y, to.y) + PLAYER_HEIGHT;
+    double lo_z = std::fmin(from.z, to.z) - half_width;
+    double hi_z = std::fmax(from.z, to.z) + half_width;
+
+    // Fences and walls reach half a block into the block above them
+    int32_t bx0 = static_cast<int32_t>(std::floor(lo_x));
+    int32_t by0 = static_cast<int32_t>(std::floor(lo_y)) - 1;
+    int32_t bz0 = static_cast<int32_t>(std::floor(lo_z));
+    int32_t bx1 = static_cast<int32_t>(std::floor(hi_x));
+    int32_t by1 = static_cast<int32_t>(std::floor(hi_y));
+    int32_t bz1 = static_cast<int32_t>(std::floor(hi_z));
+
+    if (by0 < WORLD_MIN_Y) by0 = WORLD_MIN_Y;
+    if (by1 > WORLD_MAX_Y) by1 = WORLD_MAX_Y;
+
+    // Boxes are stored relative to the start position and expanded by the
+    // player extents, which turns the box sweep into a point sweep
+    const float expand_xz = static_cast<float>(half_width) - COLLISION_EPSILON;
+    const float expand_down = static_cast<float>(PLAYER_HEIGHT) - COLLISION_EPSILON;
+
+    batch.clear();
+    for (int32_t by = by0; by <= by1; by++)
+    {
+        for (int32_t bz = bz0; bz <= bz1; bz++)
+        {
+            for (int32_t bx = bx0; bx <= bx1; bx++)
+            {
+                uint32_t count;
+                const aabbf_t* boxes = shapes.get(world.get_block_state(bx, by, bz), count);
+
+                float rx = static_cast<float>(bx - from.x);
+                float ry = static_cast<float>(by - from.y);
+                float rz = static_cast<float>(bz - from.z);
+
+                for (uint32_t i = 0; i < count; i++)
+                {
+                    const aabbf_t& box = boxes[i];
+                    batch.push
+                    (
+                        rx + box.min_x - expand_xz, ry + box.min_y - expand_down, rz + box.min_z - expand_xz,
+                        rx + box.max_x + expand_xz, ry + box.max_y - COLLISION_EPSILON, rz + box.max_z + expand_xz
+                    );
+                }
+            }
+        }
+    }
+
+    if (batch.count == 0)
+        return false;
+    batch.pad();
+
+    float delta[3] =
+    {
+        static_cast<float>(to.x - from.x),
+        static_cast<float>(to.y - from.y),
+        static_cast<float>(to.z - from.z)
+    };
+
+    if (!batch.sweep(0.f, 0.f, 0.f, delta[0], delta[1], delta[2]))
+        return false;
+
+    for (const uint8_t* order : axis_orders)
+    {
+        float at[3] = { 0.f, 0.f, 0.f };
+        bool blocked = false;
+
+        for (int leg = 0; leg < 3 && !blocked; leg++)
+        {
+            int axis = order[leg];
+            if (delta[axis] == 0.f)
+                continue;
+
+            float step[3] = { 0.f, 0.f, 0.f };
+            step[axis] = delta[axis];
+            blocked = batch.sweep(at[0], at[1], at[2], step[0], step[1], step[2]);
+            at[axis] += delta[axis];
+        }
+
+        if (!blocked)
+            return false;
+    }
+
+    return true;
+}
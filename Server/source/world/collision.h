@@ -0,0 +1,55 @@
+#ifndef IMPL_COLLISION_H
+#define IMPL_COLLISION_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include "world.h"
+#include "../math/math.h"
+
+#define PLAYER_WIDTH    0.6
+#define PLAYER_HEIGHT   1.8
+
+// Collision boxes of every 1.12 block state, in block local coordinates.
+// Built once; shapes that depend on neighbours or on hidden state (fences,
+// doors, panes, ...) are under-approximated so the validator errs towards
+// accepting legitimate movement.
+class c_block_shapes
+{
+private:
+    std::vector<aabbf_t> boxes;
+    std::vector<uint32_t> index; // per state: offset << 8 | count
+
+    void set(uint8_t block_id, int meta, const aabbf_t* shape, uint32_t count);
+    void set_all(uint8_t block_id, const aabbf_t* shape, uint32_t count);
+public:
+    c_block_shapes();
+
+    const aabbf_t* get(block_state_t state, uint32_t& count) const;
+
+    static const c_block_shapes& instance();
+};
+
+// Boxes gathered around a movement, already expanded by the player extents
+// and stored as SoA so four of them can be tested per SIMD instruction.
+class c_collision_batch
+{
+public:
+    std::vector<float> min_x, min_y, min_z;
+    std::vector<float> max_x, max_y, max_z;
+    size_t count = 0;
+
+    void clear();
+    void push(float x0, float y0, float z0, float x1, float y1, float z1);
+    void pad();
+
+    // true if a point moving from origin by delta enters any box
+    bool sweep(float ox, float oy, float oz, float dx, float dy, float dz) const;
+};
+
+// Sweeps the player AABB from one feet position to another through the
+// block grid. Returns true if the move passes through solid blocks.
+bool collision_sweep(const c_world& world, const vec3d_t& from, const vec3d_t& to);
+
+#endif
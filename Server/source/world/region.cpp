@@ -0,0 +1,230 @@
+#include "region.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static inline uint32_t read_be32(const uint8_t* p)
+{
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+        (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+c_region_file::c_region_file()
+    : base(nullptr), size(0), locations{}, invalid(0)
+#ifdef _WIN32
+    , file(INVALID_HANDLE_VALUE), mapping(nullptr)
+#endif
+{
+}
+
+c_region_file::~c_region_file()
+{
+    this->unmap();
+}
+
+void c_region_file::unmap()
+{
+#ifdef _WIN32
+    if (this->base)
+        UnmapViewOfFile(this->base);
+    if (this->mapping)
+        CloseHandle(this->mapping);
+    if (this->file != INVALID_HANDLE_VALUE)
+        CloseHandle(this->file);
+    this->mapping = nullptr;
+    this->file = INVALID_HANDLE_VALUE;
+#else
+    if (this->base)
+        munmap(const_cast<uint8_t*>(this->base), this->size);
+#endif
+    this->base = nullptr;
+    this->size = 0;
+}
+
+bool c_region_file::open(const std::string& path)
+{
+    this->unmap();
+
+#ifdef _WIN32
+    this->file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+        OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+    if (this->file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(this->file, &file_size) || file_size.QuadPart < REGION_HEADER_BYTES)
+    {
+        this->unmap();
+        return false;
+    }
+
+    this->mapping = CreateFileMappingA(this->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    void* view = this->mapping ? MapViewOfFile(this->mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!view)
+    {
+        this->unmap();
+        return false;
+    }
+    this->size = static_cast<size_t>(file_size.QuadPart);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < REGION_HEADER_BYTES)
+    {
+        close(fd);
+        return false;
+    }
+
+    void* view = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (view == MAP_FAILED)
+        return false;
+
+    // Chunks are scattered over the file, read ahead would mostly fetch
+    // neighbours nobody asked for
+    madvise(view, static_cast<size_t>(info.st_size), MADV_RANDOM);
+    this->size = static_cast<size_t>(info.st_size);
+#endif
+    this->base = static_cast<const uint8_t*>(view);
+
+    // The file may have grown by a partial sector, only whole ones count
+    uint32_t sectors = static_cast<uint32_t>(this->size / REGION_SECTOR_BYTES);
+    this->invalid = 0;
+    for (int i = 0; i < REGION_CHUNKS; i++)
+    {
+        uint32_t entry = read_be32(this->base + i * 4);
+        uint32_t first = entry >> 8;
+        uint32_t count = entry & 0xFF;
+
+        if (entry && (first < 2 || !count || first + count > sectors))
+        {
+            this->invalid++;
+            entry = 0;
+        }
+        this->locations[i] = entry;
+    }
+    return true;
+}
+
+bool c_region_file::get_chunk(int32_t x, int32_t z, region_chunk_t& out) const
+{
+    int i = (z & 31) * 32 + (x & 31);
+    uint32_t entry = this->locations[i];
+    if (!entry)
+        return false;
+
+    size_t offset = static_cast<size_t>(entry >> 8) * REGION_SECTOR_BYTES;
+    size_t available = static_cast<size_t>(entry & 0xFF) * REGION_SECTOR_BYTES;
+
+#ifndef _WIN32
+    // One request for all of the chunk's sectors rather than a fault each
+    static const uintptr_t page_mask = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE)) - 1;
+    uintptr_t start = reinterpret_cast<uintptr_t>(this->base + offset);
+    uintptr_t page = start & ~page_mask;
+    madvise(reinterpret_cast<void*>(page), available + (start - page), MADV_WILLNEED);
+#endif
+
+    const uint8_t* header = this->base + offset;
+    uint32_t length = read_be32(header);
+    uint8_t compression = header[4];
+
+    // The length counts the compression byte; chunks stored in an external
+    // .mcc file (compression | 128) aren't supported
+    if (length < 1 || length > available - 4 || compression < region_gzip || compression > region_uncompressed)
+        return false;
+
+    out.data = header + 5;
+    out.size = length - 1;
+    out.compression = static_cast<region_compression_t>(compression);
+    out.timestamp = read_be32(this->base + REGION_SECTOR_BYTES + i * 4);
+    return true;
+}
+
+c_region_cache::c_region_cache()
+    : capacity(16)
+{
+}
+
+void c_region_cache::configure(const std::string& directory, size_t capacity)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->directory = directory;
+    this->capacity = capacity < 1 ? 1 : capacity;
+    this->lru.clear();
+    this->index.clear();
+}
+
+std::shared_ptr<c_region_file> c_region_cache::get(chunk_pos_t chunk)
+{
+    int32_t rx = chunk.x >> 5;
+    int32_t rz = chunk.z >> 5;
+    uint64_t key = chunk_key({ rx, rz });
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    auto found = this->index.find(key);
+    if (found != this->index.end())
+    {
+        this->lru.splice(this->lru.begin(), this->lru, found->second);
+        return found->second->region;
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "/region/r.%d.%d.mca", rx, rz);
+
+    // Opening under the lock keeps two threads from mapping the same file;
+    // it's only a syscall or two, the data is paged in later
+    std::shared_ptr<c_region_file> region = std::make_shared<c_region_file>();
+    if (!region->open(this->directory + name))
+    {
+        region.reset();
+    }
+    else if (region->get_invalid_entries())
+    {
+        printf("Region %s has %u chunk entries pointing outside the file\r\n", name + 1, region->get_invalid_entries());
+    }
+
+    this->lru.push_front({ key, region });
+    this->index[key] = this->lru.begin();
+
+    while (this->lru.size() > this->capacity)
+    {
+        this->index.erase(this->lru.back().key);
+        this->lru.pop_back();
+    }
+    return region;
+}
+
+bool c_region_cache::read_chunk(chunk_pos_t chunk, region_chunk_t& out, std::shared_ptr<c_region_file>& region)
+{
+    region = this->get(chunk);
+    return region && region->get_chunk(chunk.x & 31, chunk.z & 31, out);
+}
+
+size_t c_region_cache::get_open_count()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    size_t open = 0;
+    for (cached_region_t& cached : this->lru)
+    {
+        if (cached.region)
+            open++;
+    }
+    return open;
+}
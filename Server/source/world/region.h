@@ -0,0 +1,104 @@
+#ifndef IMPL_REGION_H
+#define IMPL_REGION_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "world.h"
+
+#define REGION_CHUNKS			1024		// 32x32 columns per file
+#define REGION_SECTOR_BYTES		4096
+#define REGION_HEADER_BYTES		(2 * REGION_SECTOR_BYTES)
+
+typedef enum
+{
+	region_gzip = 1,
+	region_zlib = 2,
+	region_uncompressed = 3
+}
+region_compression_t;
+
+// A chunk as stored in the file, still compressed. Points into the
+// mapping, so the region it came from has to be kept alive while in use.
+typedef struct
+{
+	const uint8_t* data;
+	size_t size;
+	region_compression_t compression;
+	uint32_t timestamp;
+}
+region_chunk_t;
+
+// One anvil region file (r.<x>.<z>.mca), mapped read only. The location
+// table is checked once when the file is opened; a chunk's bytes are only
+// touched, and paged in, when it's asked for.
+class c_region_file
+{
+private:
+	const uint8_t* base;
+	size_t size;
+	uint32_t locations[REGION_CHUNKS];		// first sector << 8 | sector count, 0 when absent
+	uint32_t invalid;
+#ifdef _WIN32
+	void* file;
+	void* mapping;
+#endif
+
+	void unmap();
+public:
+	c_region_file();
+	~c_region_file();
+	c_region_file(const c_region_file&) = delete;
+	c_region_file& operator=(const c_region_file&) = delete;
+
+	bool open(const std::string& path);
+
+	// Chunk coordinates inside the region, 0..31. false when the chunk was
+	// never generated or its entry doesn't hold together
+	bool get_chunk(int32_t x, int32_t z, region_chunk_t& out) const;
+	bool has_chunk(int32_t x, int32_t z) const { return this->locations[(z & 31) * 32 + (x & 31)] != 0; }
+
+	// Location entries pointing outside the file, dropped when opened
+	uint32_t get_invalid_entries() const { return this->invalid; }
+};
+
+// The region files of one world directory, opened on first use. The most
+// recently used ones stay mapped; a file that doesn't exist is remembered
+// too, so the edges of the world don't cost an open() each time.
+class c_region_cache
+{
+private:
+	typedef struct
+	{
+		uint64_t key;
+		std::shared_ptr<c_region_file> region;	// null when there's no file
+	}
+	cached_region_t;
+
+	std::mutex mutex;
+	std::string directory;
+	size_t capacity;
+	std::list<cached_region_t> lru;			// most recent first
+	std::unordered_map<uint64_t, std::list<cached_region_t>::iterator> index;
+public:
+	c_region_cache();
+
+	// The world directory, region files are read from its region folder
+	void configure(const std::string& directory, size_t capacity);
+
+	// Region containing the chunk, null without one; the returned file
+	// stays valid after it's evicted. Any thread.
+	std::shared_ptr<c_region_file> get(chunk_pos_t chunk);
+
+	// Compressed chunk bytes, with the region that holds them
+	bool read_chunk(chunk_pos_t chunk, region_chunk_t& out, std::shared_ptr<c_region_file>& region);
+
+	size_t get_open_count();
+};
+
+#endif
@@ -0,0 +1,91 @@
+#include "world.h"
+#include "chunk.h"
+
+#include "../protocol/packets.h"
+
+c_world::c_world()
+    : sky_light(true)
+{
+    this->cache_stats.packet_hits = 0;
+    this->cache_stats.packet_builds = 0;
+    this->cache_stats.cached_bytes = 0;
+}
+
+c_world::~c_world() = default;
+
+const c_chunk* c_world::get_chunk(chunk_pos_t pos) const
+{
+    auto it = this->chunks.find(chunk_key(pos));
+    return it == this->chunks.end() ? nullptr : it->second.get();
+}
+
+c_chunk* c_world::get_chunk(chunk_pos_t pos)
+{
+    auto it = this->chunks.find(chunk_key(pos));
+    return it == this->chunks.end() ? nullptr : it->second.get();
+}
+
+void c_world::add_chunk(std::unique_ptr<c_chunk> chunk)
+{
+    uint64_t key = chunk_key(chunk->get_pos());
+    chunk->set_stats(&this->cache_stats);
+    this->chunks[key] = std::move(chunk);
+}
+
+void c_world::remove_chunk(chunk_pos_t pos)
+{
+    this->chunks.erase(chunk_key(pos));
+}
+
+size_t c_world::remove_chunks_except(const std::unordered_set<uint64_t>& keep)
+{
+    size_t removed = 0;
+    for (auto it = this->chunks.begin(); it != this->chunks.end();)
+    {
+        if (keep.count(it->first))
+        {
+            ++it;
+            continue;
+        }
+
+        it = this->chunks.erase(it);
+        removed++;
+    }
+    return removed;
+}
+
+block_state_t c_world::get_block_state(int32_t x, int32_t y, int32_t z) const
+{
+    const c_chunk* chunk = this->get_chunk({ x >> 4, z >> 4 });
+    return chunk ? chunk->get_block_state(x & 0xF, y, z & 0xF) : 0;
+}
+
+void c_world::set_block_state(int32_t x, int32_t y, int32_t z, block_state_t state)
+{
+    c_chunk* chunk = this->get_chunk({ x >> 4, z >> 4 });
+    if (chunk)
+        chunk->set_block_state(x & 0xF, y, z & 0xF, state);
+}
+
+packet_buffer_t c_world::get_chunk_packet(chunk_pos_t pos) const
+{
+    const c_chunk* chunk = this->get_chunk(pos);
+    if (chunk)
+        return chunk->get_packet(this->sky_light);
+
+    // Full column without sections, only the biome array follows
+    std::vector<uint8_t> biomes(256, 1);
+    c_s2c_chunk_data chunk_data = c_s2c_chunk_data
+    (
+        pos.x, pos.z,
+        1,
+        0,
+        std::move(biomes),
+        0,
+        ""
+    );
+
+    c_packet packet;
+    chunk_data.serialize(packet);
+    return std::make_shared<const std::vector<uint8_t>>(std::move(packet.get_raw()));
+}
@@ -0,0 +1,91 @@
+#ifndef IMPL_WORLD_H
+#define IMPL_WORLD_H
+
+#include <stdint.h>
+#include <cmath>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "../protocol/packet.h"
+
+// Global block state id as used by the 1.12 protocol: (block_id << 4) | meta
+typedef uint16_t block_state_t;
+
+#define BLOCK_STATE(id, meta) ((block_state_t)(((id) << 4) | ((meta) & 0xF)))
+#define BLOCK_ID(state) ((state) >> 4)
+#define BLOCK_META(state) ((state) & 0xF)
+
+#define WORLD_MIN_Y 0
+#define WORLD_MAX_Y 255
+
+typedef struct
+{
+	int32_t x;
+	int32_t z;
+}
+chunk_pos_t;
+
+static inline uint64_t chunk_key(chunk_pos_t pos)
+{
+	return (static_cast<uint64_t>(static_cast<uint32_t>(pos.x)) << 32) | static_cast<uint32_t>(pos.z);
+}
+
+static inline chunk_pos_t chunk_from_key(uint64_t key)
+{
+	return { static_cast<int32_t>(key >> 32), static_cast<int32_t>(key & 0xFFFFFFFF) };
+}
+
+static inline chunk_pos_t chunk_from_block(double x, double z)
+{
+	return { static_cast<int32_t>(std::floor(x)) >> 4, static_cast<int32_t>(std::floor(z)) >> 4 };
+}
+
+// Counters shared by the chunks of a world
+typedef struct
+{
+	std::atomic<uint64_t> packet_hits;		// sends served from the cache
+	std::atomic<uint64_t> packet_builds;	// sends that had to encode
+	std::atomic<int64_t> cached_bytes;
+}
+chunk_cache_stats_t;
+
+class c_chunk;
+
+// Loaded chunk columns. Read from the region workers during a tick, so
+// chunks are only added, removed or edited by the tick thread outside the
+// region phase.
+class c_world
+{
+private:
+	chunk_cache_stats_t cache_stats;		// before the chunks, which update it until destroyed
+	std::unordered_map<uint64_t, std::unique_ptr<c_chunk>> chunks;
+	bool sky_light;
+public:
+	c_world();
+	~c_world();
+	c_world(const c_world&) = delete;
+	c_world& operator=(const c_world&) = delete;
+
+	const c_chunk* get_chunk(chunk_pos_t pos) const;
+	c_chunk* get_chunk(chunk_pos_t pos);
+	void add_chunk(std::unique_ptr<c_chunk> chunk);
+	void remove_chunk(chunk_pos_t pos);
+
+	// Drops every column whose key isn't in keep, returns how many went
+	size_t remove_chunks_except(const std::unordered_set<uint64_t>& keep);
+	size_t get_chunk_count() const { return this->chunks.size(); }
+
+	// Air outside loaded chunks
+	block_state_t get_block_state(int32_t x, int32_t y, int32_t z) const;
+	void set_block_state(int32_t x, int32_t y, int32_t z, block_state_t state);
+
+	// Chunk Data packet of a column, shared with every other player that
+	// gets the same chunk; chunks that aren't loaded go out empty
+	packet_buffer_t get_chunk_packet(chunk_pos_t pos) const;
+
+	const chunk_cache_stats_t& get_cache_stats() const { return this->cache_stats; }
+};
+
+#endif